@@ -0,0 +1,170 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_BATCH_H_
+#define CAPNP_ALTCXX_BATCH_H_
+
+#include <limits.h>
+#include <sys/uio.h>
+#include <kj/async-io.h>
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include <capnp/endian.h>
+#include <capnp/message.h>
+
+namespace capnp {
+namespace altcxx {
+
+class MessageBatch {
+  // Collects messages and writes them in the standard stream format with as few system calls
+  // as possible, by handing the kernel each segment table and segment directly in one writev()
+  // instead of copying them into a stream buffer.  Messages must not be modified until the
+  // batch is written.
+  //
+  // For the async variant, the batch hands its messages over to the write, which keeps them
+  // alive until it completes, so the batch can be refilled right away.
+
+public:
+  MessageBatch() = default;
+  MessageBatch(MessageBatch&&) = default;
+  MessageBatch& operator=(MessageBatch&&) = default;
+  KJ_DISALLOW_COPY(MessageBatch);
+
+  void add(MessageBuilder& message) {
+    // `message` must outlive the write.
+    add(message.getSegmentsForOutput(), nullptr);
+  }
+
+  void add(kj::Own<MessageBuilder>&& message) {
+    auto segments = message->getSegmentsForOutput();
+    add(segments, kj::mv(message));
+  }
+
+  size_t size() const { return messages.size(); }
+  size_t getByteCount() const { return byteCount; }
+
+  void write(int fd) {
+    // Writes out all messages and empties the batch.
+
+    auto pieces = getPieces();
+    kj::Vector<struct iovec> iov(pieces.size());
+    for (auto& piece: pieces) {
+      iov.add(iovec { const_cast<byte*>(piece.begin()), piece.size() });
+    }
+
+    struct iovec* current = iov.begin();
+    struct iovec* end = iov.end();
+    while (current < end) {
+      ssize_t written;
+      int count = kj::min(size_t(end - current), size_t(IOV_MAX));
+      KJ_SYSCALL(written = ::writev(fd, current, count), fd);
+
+      // Skip what got written; the last piece may only be partially done.
+      while (current < end && size_t(written) >= current->iov_len) {
+        written -= current->iov_len;
+        ++current;
+      }
+      if (written > 0) {
+        current->iov_base = reinterpret_cast<byte*>(current->iov_base) + written;
+        current->iov_len -= written;
+      }
+    }
+
+    clear();
+  }
+
+  kj::Promise<void> write(kj::AsyncOutputStream& output) {
+    // Starts writing all messages and empties the batch.
+
+    auto flight = kj::heap<InFlight>();
+    flight->pieces = getPieces();
+    flight->messages = kj::mv(messages);
+    messages = kj::Vector<Message>();
+    byteCount = 0;
+
+    auto promise = output.write(flight->pieces);
+    return promise.then(kj::mvCapture(flight, [](kj::Own<InFlight>&&) {}));
+  }
+
+  void clear() {
+    messages.clear();
+    byteCount = 0;
+  }
+
+private:
+  struct Message {
+    kj::Own<MessageBuilder> owned;
+    kj::ArrayPtr<const kj::ArrayPtr<const word>> segments;
+    kj::Array<_::WireValue<uint32_t>> table;
+  };
+
+  struct InFlight {
+    kj::Array<kj::ArrayPtr<const byte>> pieces;
+    kj::Vector<Message> messages;
+  };
+
+  kj::Vector<Message> messages;
+  size_t byteCount = 0;
+
+  void add(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments, kj::Own<MessageBuilder> owned) {
+    KJ_REQUIRE(segments.size() > 0, "Tried to write a message with no segments.");
+
+    // Segment count minus one, then each segment size, padded to a whole number of words.
+    auto table = kj::heapArray<_::WireValue<uint32_t>>((segments.size() + 2) & ~size_t(1));
+    table[0].set(segments.size() - 1);
+    for (uint i = 0; i < segments.size(); i++) {
+      table[i + 1].set(segments[i].size());
+      byteCount += segments[i].size() * sizeof(word);
+    }
+    if (segments.size() % 2 == 0) {
+      table[segments.size() + 1].set(0);
+    }
+    byteCount += table.size() * sizeof(table[0]);
+
+    messages.add(Message { kj::mv(owned), segments, kj::mv(table) });
+  }
+
+  kj::Array<kj::ArrayPtr<const byte>> getPieces() {
+    size_t count = 0;
+    for (auto& message: messages) {
+      count += message.segments.size() + 1;
+    }
+
+    auto pieces = kj::heapArrayBuilder<kj::ArrayPtr<const byte>>(count);
+    for (auto& message: messages) {
+      pieces.add(kj::arrayPtr(reinterpret_cast<const byte*>(message.table.begin()),
+                              message.table.size() * sizeof(message.table[0])));
+      for (auto segment: message.segments) {
+        pieces.add(kj::arrayPtr(reinterpret_cast<const byte*>(segment.begin()),
+                                segment.size() * sizeof(word)));
+      }
+    }
+    return pieces.finish();
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_BATCH_H_
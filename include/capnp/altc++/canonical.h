@@ -0,0 +1,570 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CAPNP_ALTCXX_CANONICAL_H_
+#define CAPNP_ALTCXX_CANONICAL_H_
+
+#include <string.h>
+#include <vector>
+#include <kj/array.h>
+#include <kj/debug.h>
+#include <capnp/any.h>
+#include <capnp/endian.h>
+#include <capnp/message.h>
+#include "impl.h"
+
+namespace capnp {
+namespace altcxx {
+
+// Canonical form of a message, for deduplication and content addressing.
+//
+// CanonicalWriter writes a struct as a single segment message in which every object follows the
+// one pointing to it in pre-order, a struct's pointers being taken in index order.  Struct data
+// sections are trimmed of trailing zero words, pointer sections end at the last non-null pointer,
+// and struct lists use the largest trimmed element.  Far pointers and the segment layout of the
+// original message don't show in the result, so equal values give equal words whichever way
+// they were built.
+//
+// The walk is driven by the generated _visit() of each struct, so pointers in inactive union
+// members are dropped.  Pointers past the ones known to the schema, and the targets of AnyPointer
+// fields, are copied without a schema: capnp first lays such a target out in a single segment,
+// and its raw pointers are followed from there, keeping every pointer that isn't null.
+// Capabilities have no canonical form and throw if set.
+//
+// Optionally the writer hashes the result while writing it.  The hash sums a mix of each word
+// with its position, so it doesn't depend on the order in which words are written; it's meant
+// for hash tables and dedup indexes, not as a cryptographic digest.
+
+class CanonicalWriter {
+public:
+  explicit CanonicalWriter(bool hashing = false): hashing(hashing) {}
+
+  KJ_DISALLOW_COPY(CanonicalWriter);
+
+  template <typename T>
+  kj::ArrayPtr<const word> write(Reader<T> value) {
+    // Returns the canonical words, which stay valid until the next write().  The buffer is reused
+    // between writes.
+    used = 0;
+    sum = 0;
+    allocate(1);
+    writeStruct<T>(0, ReaderImpl::asStruct(&value));
+    return kj::arrayPtr<const word>(buffer.begin(), used);
+  }
+
+  uint64_t getHash() const {
+    // Hash of the words returned by the last write(); requires hashing.
+    KJ_REQUIRE(hashing, "CanonicalWriter was constructed without hashing.");
+    return finishHash(sum, used);
+  }
+
+  static uint64_t hash(kj::ArrayPtr<const word> words) {
+    // Same as getHash() of a writer which wrote `words`.
+    uint64_t result = 0;
+    for (size_t i = 0; i < words.size(); i++) {
+      uint64_t value = reinterpret_cast<const _::WireValue<uint64_t>*>(&words[i])->get();
+      if (value != 0) result += mix(i, value);
+    }
+    return finishHash(result, words.size());
+  }
+
+private:
+  enum ElementSize: uint8_t {
+    VOID, BIT, BYTE, TWO_BYTES, FOUR_BYTES, EIGHT_BYTES, POINTER, INLINE_COMPOSITE
+  };
+
+  bool hashing;
+  kj::Array<word> buffer;
+  size_t used = 0;
+  uint64_t sum = 0;
+
+  typedef void Copier(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr);
+  std::vector<Copier*> copiers;
+  // A stack of the copiers of the pointer sections being written, filled by Visitor<true>.
+
+  template <typename T, Kind k = kind<T>()>
+  struct CopyPointer;
+  template <typename T, Kind k = kind<T>()>
+  struct CopyList;
+  template <typename T>
+  struct Primitive;
+
+  template <bool copying>
+  class Visitor {
+    // Without copying, finds the number of pointers a struct needs; with it, records how to copy
+    // each of them in the writer's copiers from `base` on, since _visit() follows the schema's
+    // field order rather than the order of the pointer section.
+
+  public:
+    Visitor(CanonicalWriter* writer, _::StructReader s, size_t base)
+        : writer(writer), s(s), base(base) {}
+
+    uint count = 0;
+
+    template <typename T>
+    void field(uint offset) {
+      if (s.getPointerField(offset).isNull()) return;
+      if (copying) {
+        writer->copiers[base + offset] = &CopyPointer<T>::copy;
+      } else {
+        count = kj::max(count, offset + 1);
+      }
+    }
+
+    template <typename T>
+    void unionField(uint offset, uint discrimOffset, uint16_t value) {
+      if (isActive(discrimOffset, value)) field<T>(offset);
+    }
+
+    template <typename G>
+    void group() { G::_visit(*this); }
+
+    template <typename G>
+    void unionGroup(uint discrimOffset, uint16_t value) {
+      if (isActive(discrimOffset, value)) G::_visit(*this);
+    }
+
+  private:
+    CanonicalWriter* writer;
+    _::StructReader s;
+    size_t base;
+
+    bool isActive(uint discrimOffset, uint16_t value) {
+      return s.getDataField<uint16_t>(discrimOffset * ELEMENTS) == value;
+    }
+  };
+
+  size_t allocate(size_t count) {
+    // Returns the index of `count` new zeroed words.  Indexes stay valid as the buffer grows.
+    if (used + count > buffer.size()) {
+      auto grown = kj::heapArray<word>(kj::max(buffer.size() * 2, used + count + 64));
+      if (used > 0) memcpy(grown.begin(), buffer.begin(), used * sizeof(word));
+      buffer = kj::mv(grown);
+    }
+    memset(buffer.begin() + used, 0, count * sizeof(word));
+    size_t result = used;
+    used += count;
+    return result;
+  }
+
+  void hashWords(size_t index, size_t count) {
+    if (!hashing) return;
+    for (size_t i = index; i < index + count; i++) {
+      uint64_t value = reinterpret_cast<const _::WireValue<uint64_t>*>(&buffer[i])->get();
+      if (value != 0) sum += mix(i, value);
+    }
+  }
+
+  void setWord(size_t index, uint64_t value) {
+    reinterpret_cast<_::WireValue<uint64_t>*>(&buffer[index])->set(value);
+    if (hashing && value != 0) sum += mix(index, value);
+  }
+
+  static uint64_t mix(uint64_t a, uint64_t b) {
+    // splitmix64's finalizer over both inputs.
+    uint64_t x = b ^ (a + 1) * 0x9e3779b97f4a7c15ull;
+    x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ x >> 27) * 0x94d049bb133111ebull;
+    return x ^ x >> 31;
+  }
+
+  static uint64_t finishHash(uint64_t sum, size_t count) { return mix(count, mix(0, sum)); }
+
+  static uint64_t offsetBits(size_t pointer, size_t target) {
+    // Offset from the end of the pointer, in bits 2-31.
+    return static_cast<uint32_t>(target - pointer - 1) << 2;
+  }
+
+  static uint64_t structPointer(uint64_t offset, uint dataWords, uint pointers) {
+    return offset | static_cast<uint64_t>(dataWords) << 32 | static_cast<uint64_t>(pointers) << 48;
+  }
+
+  void setStructPointer(size_t pointer, size_t target, uint dataWords, uint pointers) {
+    // Zero-sized structs point just behind their pointer, as capnp's own canonical form does.
+    uint64_t offset = dataWords + pointers == 0 ? 0xfffffffcu : offsetBits(pointer, target);
+    setWord(pointer, structPointer(offset, dataWords, pointers));
+  }
+
+  void setListPointer(size_t pointer, size_t target, ElementSize size, uint64_t count) {
+    setWord(pointer, offsetBits(pointer, target) | 1 | static_cast<uint64_t>(size) << 32 |
+                     count << 35);
+  }
+
+  static uint dataWords(_::StructReader s) {
+    auto data = s.getDataSectionAsBlob();
+    size_t size = data.size();
+    while (size > 0 && data[size - 1] == 0) size--;
+    // A one-bit data section (a struct read from a list of bools) has no whole byte to show.
+    if (data.size() == 0 && s.getDataField<bool>(0 * ELEMENTS)) return 1;
+    return (size + sizeof(word) - 1) / sizeof(word);
+  }
+
+  template <typename T>
+  static uint pointerCount(_::StructReader s) {
+    Visitor<false> visitor(nullptr, s, 0);
+    T::_visit(visitor);
+    uint count = visitor.count;
+    for (uint i = schemaPointers<T>(); i < s.getPointerSectionSize() / POINTERS; i++) {
+      if (!s.getPointerField(i).isNull()) count = i + 1;
+    }
+    return count;
+  }
+
+  template <typename T>
+  static uint schemaPointers() { return _::structSize<T>().pointers / POINTERS; }
+
+  void copyData(size_t index, _::StructReader s, uint count) {
+    auto data = s.getDataSectionAsBlob();
+    if (data.size() == 0) {
+      if (count > 0 && s.getDataField<bool>(0 * ELEMENTS)) setWord(index, 1);
+      return;
+    }
+    memcpy(&buffer[index], data.begin(), kj::min(data.size(), count * sizeof(word)));
+    hashWords(index, count);
+  }
+
+  template <typename T>
+  void copyPointers(size_t index, _::StructReader s, uint count) {
+    // Copies the targets of the first `count` pointers of `s` behind the pointer section at
+    // `index`.  Pointers the visitor skipped, such as those of inactive union members, stay null.
+    size_t base = copiers.size();
+    copiers.resize(base + count, nullptr);
+    Visitor<true> visitor(this, s, base);
+    T::_visit(visitor);
+
+    uint known = schemaPointers<T>();
+    for (uint i = 0; i < count; i++) {
+      if (i >= known) {
+        auto ptr = s.getPointerField(i);
+        if (!ptr.isNull()) copyAny(index + i, ptr);
+      } else if (copiers[base + i] != nullptr) {
+        // Copiers deeper down push onto the stack, so look this one up before calling it.
+        Copier* copier = copiers[base + i];
+        copier(*this, index + i, s.getPointerField(i));
+      }
+    }
+    copiers.resize(base);
+  }
+
+  template <typename T>
+  void copyPointerList(size_t pointer, _::PointerReader ptr) {
+    // Read untyped, so null elements stay null rather than becoming empty values.
+    auto list = ptr.getList(_::ElementSize::POINTER, nullptr);
+    uint count = list.size() / ELEMENTS;
+    size_t index = allocate(count);
+    setListPointer(pointer, index, POINTER, count);
+    for (uint i = 0; i < count; i++) {
+      auto element = list.getPointerElement(i * ELEMENTS);
+      if (!element.isNull()) CopyPointer<T>::copy(*this, index + i, element);
+    }
+  }
+
+  template <typename T>
+  void writeStruct(size_t pointer, _::StructReader s) {
+    uint data = dataWords(s);
+    uint pointers = pointerCount<T>(s);
+    size_t index = allocate(data + pointers);
+    setStructPointer(pointer, index, data, pointers);
+    copyData(index, s, data);
+    copyPointers<T>(index + data, s, pointers);
+  }
+
+  // Copying without a schema.  The source is a single segment built by copyAny(), so there are
+  // no far pointers and every pointer is known to be in bounds.
+
+  void copyAny(size_t pointer, _::PointerReader ptr) {
+    MallocMessageBuilder flat(ptr.targetSize().wordCount + 1);
+    flat.getRoot<AnyPointer>().set(AnyPointer::Reader(ptr));
+    auto segments = flat.getSegmentsForOutput();
+    KJ_ASSERT(segments.size() == 1, "Flat copy took more than one segment.");
+    copyRaw(pointer, segments[0].begin());
+  }
+
+  static uint64_t wordAt(const word* source) {
+    return reinterpret_cast<const _::WireValue<uint64_t>*>(source)->get();
+  }
+
+  static uint rawDataWords(const word* source, uint words) {
+    auto bytes = reinterpret_cast<const byte*>(source);
+    size_t size = words * sizeof(word);
+    while (size > 0 && bytes[size - 1] == 0) size--;
+    return (size + sizeof(word) - 1) / sizeof(word);
+  }
+
+  static uint rawPointerCount(const word* source, uint count) {
+    while (count > 0 && wordAt(source + count - 1) == 0) count--;
+    return count;
+  }
+
+  void copyRawData(size_t index, const word* source, uint count) {
+    memcpy(&buffer[index], source, count * sizeof(word));
+    hashWords(index, count);
+  }
+
+  void copyRaw(size_t pointer, const word* source) {
+    uint64_t value = wordAt(source);
+    if (value == 0) return;
+    const word* target = source + 1 + (static_cast<int32_t>(value) >> 2);
+    switch (value & 3) {
+      case 0: {
+        uint sourceData = value >> 32 & 0xffff;
+        uint sourcePointers = value >> 48;
+        uint data = rawDataWords(target, sourceData);
+        uint pointers = rawPointerCount(target + sourceData, sourcePointers);
+        size_t index = allocate(data + pointers);
+        setStructPointer(pointer, index, data, pointers);
+        copyRawData(index, target, data);
+        for (uint i = 0; i < pointers; i++) {
+          copyRaw(index + data + i, target + sourceData + i);
+        }
+        break;
+      }
+      case 1:
+        copyRawList(pointer, target, static_cast<ElementSize>(value >> 32 & 7), value >> 35);
+        break;
+      default:
+        KJ_FAIL_REQUIRE("Capabilities have no canonical form.");
+    }
+  }
+
+  void copyRawList(size_t pointer, const word* source, ElementSize size, uint64_t count) {
+    switch (size) {
+      case POINTER: {
+        size_t index = allocate(count);
+        setListPointer(pointer, index, POINTER, count);
+        for (uint64_t i = 0; i < count; i++) {
+          copyRaw(index + i, source + i);
+        }
+        break;
+      }
+      case INLINE_COMPOSITE: {
+        // As for typed struct lists, all elements get the largest trimmed sections.
+        uint64_t tag = wordAt(source);
+        uint64_t elements = static_cast<uint32_t>(tag) >> 2;
+        uint sourceData = tag >> 32 & 0xffff;
+        uint sourcePointers = tag >> 48;
+        size_t sourceStep = sourceData + sourcePointers;
+        uint data = 0;
+        uint pointers = 0;
+        for (uint64_t i = 0; i < elements; i++) {
+          const word* element = source + 1 + i * sourceStep;
+          data = kj::max(data, rawDataWords(element, sourceData));
+          pointers = kj::max(pointers, rawPointerCount(element + sourceData, sourcePointers));
+        }
+
+        size_t step = data + pointers;
+        size_t index = allocate(1 + elements * step);
+        setListPointer(pointer, index, INLINE_COMPOSITE, elements * step);
+        setWord(index, structPointer(elements << 2, data, pointers));
+        for (uint64_t i = 0; i < elements; i++) {
+          copyRawData(index + 1 + i * step, source + 1 + i * sourceStep, data);
+        }
+        for (uint64_t i = 0; i < elements; i++) {
+          for (uint j = 0; j < pointers; j++) {
+            copyRaw(index + 1 + i * step + data + j, source + 1 + i * sourceStep + sourceData + j);
+          }
+        }
+        break;
+      }
+      default: {
+        // Bits past the last element are cleared.
+        static const uint BITS[] = { 0, 1, 8, 16, 32, 64 };
+        uint64_t bits = count * BITS[size];
+        size_t index = allocate((bits + 63) / 64);
+        setListPointer(pointer, index, size, count);
+        memcpy(&buffer[index], source, (bits + 7) / 8);
+        if (bits % 8 != 0) {
+          reinterpret_cast<byte*>(&buffer[index])[bits / 8] &= (1 << bits % 8) - 1;
+        }
+        hashWords(index, used - index);
+        break;
+      }
+    }
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyPointer<T, Kind::STRUCT> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    writer.writeStruct<T>(pointer, ptr.getStruct(nullptr));
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyPointer<T, Kind::BLOB> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    // Text keeps its NUL terminator.
+    auto blob = _::PointerHelpers<T>::get(ptr);
+    size_t size = blob.size() + kj::isSameType<T, Text>();
+    size_t index = writer.allocate((size + sizeof(word) - 1) / sizeof(word));
+    writer.setListPointer(pointer, index, BYTE, size);
+    memcpy(&writer.buffer[index], blob.begin(), blob.size());
+    writer.hashWords(index, writer.used - index);
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyPointer<List<T>, Kind::LIST>: public CopyList<T> {};
+
+template <>
+struct CanonicalWriter::CopyPointer<AnyPointer, Kind::OTHER> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    writer.copyAny(pointer, ptr);
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyPointer<T, Kind::INTERFACE> {
+  static void copy(CanonicalWriter&, size_t, _::PointerReader) {
+    KJ_FAIL_REQUIRE("Capabilities have no canonical form.");
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::Primitive {
+  static constexpr ElementSize SIZE =
+      sizeof(T) == 1 ? BYTE : sizeof(T) == 2 ? TWO_BYTES :
+      sizeof(T) == 4 ? FOUR_BYTES : EIGHT_BYTES;
+  static constexpr size_t BITS = sizeof(T) * 8;
+  static void store(word* words, uint index, T value) {
+    reinterpret_cast<_::WireValue<T>*>(words)[index].set(value);
+  }
+};
+
+template <>
+struct CanonicalWriter::Primitive<Void> {
+  static constexpr ElementSize SIZE = VOID;
+  static constexpr size_t BITS = 0;
+  static void store(word*, uint, Void) {}
+};
+
+template <>
+struct CanonicalWriter::Primitive<bool> {
+  static constexpr ElementSize SIZE = BIT;
+  static constexpr size_t BITS = 1;
+  static void store(word* words, uint index, bool value) {
+    if (value) reinterpret_cast<byte*>(words)[index / 8] |= 1 << index % 8;
+  }
+};
+
+template <typename T, Kind k>
+struct CanonicalWriter::CopyList {
+  // Primitives and enums.
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    auto list = _::PointerHelpers<List<T>>::get(ptr);
+    size_t count = list.size();
+    size_t index = writer.allocate((count * Primitive<T>::BITS + 63) / 64);
+    writer.setListPointer(pointer, index, Primitive<T>::SIZE, count);
+    for (uint i = 0; i < count; i++) {
+      Primitive<T>::store(&writer.buffer[index], i, list[i]);
+    }
+    writer.hashWords(index, writer.used - index);
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyList<T, Kind::STRUCT> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    // All elements get the largest trimmed data and pointer sections, and their targets follow
+    // the elements in order.
+    auto list = _::PointerHelpers<List<T>>::get(ptr);
+    uint count = list.size();
+    uint data = 0;
+    uint pointers = 0;
+    for (uint i = 0; i < count; i++) {
+      auto element = list[i];
+      auto s = ReaderImpl::asStruct(&element);
+      data = kj::max(data, dataWords(s));
+      pointers = kj::max(pointers, pointerCount<T>(s));
+    }
+
+    size_t step = data + pointers;
+    size_t index = writer.allocate(1 + count * step);
+    writer.setListPointer(pointer, index, INLINE_COMPOSITE, count * step);
+    // The tag is a struct pointer whose offset holds the element count.
+    writer.setWord(index, structPointer(static_cast<uint64_t>(count) << 2, data, pointers));
+    for (uint i = 0; i < count; i++) {
+      auto element = list[i];
+      writer.copyData(index + 1 + i * step, ReaderImpl::asStruct(&element), data);
+    }
+    for (uint i = 0; i < count; i++) {
+      auto element = list[i];
+      writer.copyPointers<T>(index + 1 + i * step + data, ReaderImpl::asStruct(&element), pointers);
+    }
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyList<T, Kind::ENUM> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    CopyList<T, Kind::PRIMITIVE>::copy(writer, pointer, ptr);
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyList<T, Kind::BLOB> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    writer.copyPointerList<T>(pointer, ptr);
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyList<T, Kind::LIST> {
+  static void copy(CanonicalWriter& writer, size_t pointer, _::PointerReader ptr) {
+    writer.copyPointerList<T>(pointer, ptr);
+  }
+};
+
+template <typename T>
+struct CanonicalWriter::CopyList<T, Kind::INTERFACE> {
+  static void copy(CanonicalWriter&, size_t, _::PointerReader) {
+    KJ_FAIL_REQUIRE("Capabilities have no canonical form.");
+  }
+};
+
+// ---------------------------------------------------------------------------------------
+
+template <typename T>
+kj::Array<word> canonicalize(Reader<T> value) {
+  // Returns the canonical form of `value` as a single segment message.
+  CanonicalWriter writer;
+  return kj::heapArray(writer.write(value));
+}
+
+template <typename T>
+uint64_t canonicalHash(Reader<T> value) {
+  // Hash of canonicalize(value), computed while writing it.
+  CanonicalWriter writer(true);
+  writer.write(value);
+  return writer.getHash();
+}
+
+inline uint64_t canonicalHash(kj::ArrayPtr<const word> words) {
+  // Hash of words already in canonical form.
+  return CanonicalWriter::hash(words);
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_CANONICAL_H_
@@ -0,0 +1,98 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_COMPACT_H_
+#define CAPNP_ALTCXX_COMPACT_H_
+
+#include <capnp/any.h>
+#include <capnp/message.h>
+#include <kj/memory.h>
+
+namespace capnp {
+namespace altcxx {
+
+template <typename T>
+class CompactingMessage {
+  // A message builder for long-lived messages that are mutated and re-serialized over and over.
+  //
+  // Re-initializing or replacing a pointer field leaves the previous value in the message as
+  // garbage, so such messages keep growing.  The arena offers no way to reuse that space, so
+  // instead the live data is copied into fresh segments once garbage makes up too much of the
+  // message.  Builders obtained before a compaction point into the old segments and must not be
+  // used afterwards.
+  //
+  // Capabilities can't be copied between messages this way, so T must not contain any.
+
+public:
+  explicit CompactingMessage(uint firstSegmentWords = SUGGESTED_FIRST_SEGMENT_WORDS)
+      : message(kj::heap<MallocMessageBuilder>(firstSegmentWords)) {}
+  KJ_DISALLOW_COPY(CompactingMessage);
+
+  typename T::Builder initRoot() { return message->template initRoot<T>(); }
+  typename T::Builder getRoot() { return message->template getRoot<T>(); }
+
+  MessageBuilder& getMessage() { return *message; }
+  kj::ArrayPtr<const kj::ArrayPtr<const word>> getSegmentsForOutput() {
+    return message->getSegmentsForOutput();
+  }
+
+  size_t allocatedWords() {
+    // Words used in the message's segments, garbage included.
+    size_t result = 0;
+    for (auto segment: message->getSegmentsForOutput()) {
+      result += segment.size();
+    }
+    return result;
+  }
+
+  size_t liveWords() {
+    // Words reachable from the root, including the root pointer.
+    return message->template getRoot<AnyPointer>().asReader().targetSize().wordCount + 1;
+  }
+
+  void compact() {
+    // Copies the live data into a single fresh segment, sized to fit it exactly.
+    auto fresh = kj::heap<MallocMessageBuilder>(liveWords());
+    fresh->template getRoot<AnyPointer>().set(message->template getRoot<AnyPointer>().asReader());
+    message = kj::mv(fresh);
+  }
+
+  bool compactIfBloated(uint maxGarbagePercent = 50) {
+    // Compacts if more than `maxGarbagePercent` of the allocated words are garbage.  Meant to be
+    // called before each serialization.  Returns whether it compacted.
+    size_t allocated = allocatedWords();
+    size_t garbage = allocated - kj::min(liveWords(), allocated);
+    if (garbage * 100 <= allocated * maxGarbagePercent) return false;
+    compact();
+    return true;
+  }
+
+private:
+  kj::Own<MallocMessageBuilder> message;
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_COMPACT_H_
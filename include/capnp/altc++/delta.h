@@ -0,0 +1,514 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_DELTA_H_
+#define CAPNP_ALTCXX_DELTA_H_
+
+#include <string.h>
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include <capnp/any.h>
+#include <capnp/endian.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include "impl.h"
+
+namespace capnp {
+namespace altcxx {
+
+// Field-level deltas between two versions of a struct.
+//
+// diff() compares data sections word by word and walks pointer fields using the generated
+// _visit(), descending into structs and into lists of structs of unchanged length, so a delta
+// carries only the words and subtrees that changed.  applyDelta() replays it onto a builder that
+// holds the old version.  Capabilities are not supported and interface fields are skipped.
+//
+// A delta is a sequence of words.  Each op starts with a header word holding the op in bits 0-7,
+// a count in bits 8-31 and an index in bits 32-63:
+//
+//   DATA           index: first data word, count: number of words, which follow the header
+//   SET            index: pointer, count: size of the flat message holding the new value, which
+//                  follows the header
+//   CLEAR          index: pointer
+//   ENTER          index: pointer to a struct; the following ops up to LEAVE apply to it
+//   ENTER_LIST     index: pointer to a list of structs; followed by ENTER_ELEMENTs up to LEAVE
+//   ENTER_ELEMENT  index: element; the following ops up to LEAVE apply to it
+//   LEAVE
+
+enum class DeltaOp: uint8_t {
+  DATA,
+  SET,
+  CLEAR,
+  ENTER,
+  ENTER_LIST,
+  ENTER_ELEMENT,
+  LEAVE
+};
+
+class DeltaWriter {
+public:
+  template <typename T>
+  void diffStruct(_::StructReader a, _::StructReader b) {
+    diffData(a.getDataSectionAsBlob(), b.getDataSectionAsBlob());
+    Visitor visitor(*this, a, b);
+    T::_visit(visitor);
+  }
+
+  bool empty() const { return words.size() == 0; }
+  kj::Array<word> finish() { return words.releaseAsArray(); }
+
+private:
+  kj::Vector<word> words;
+
+  template <typename T, Kind k = kind<T>()>
+  struct PointerDiff;
+  template <typename T, Kind k = kind<T>()>
+  struct ListDiff;
+  template <typename T, Kind k = kind<T>()>
+  struct ValueEqual;
+
+  class Visitor {
+  public:
+    Visitor(DeltaWriter& writer, _::StructReader a, _::StructReader b)
+        : writer(writer), a(a), b(b) {}
+
+    template <typename T>
+    void field(uint offset) {
+      if (replaceOnly) {
+        writer.replace(offset, a.getPointerField(offset), b.getPointerField(offset));
+      } else {
+        PointerDiff<T>::diff(writer, offset, a.getPointerField(offset), b.getPointerField(offset));
+      }
+    }
+
+    template <typename T>
+    void unionField(uint offset, uint discrimOffset, uint16_t value) {
+      if (!isActive(b, discrimOffset, value)) return;
+      if (!isActive(a, discrimOffset, value)) {
+        // The slot may hold another member's value in the old version.
+        writer.replace(offset, a.getPointerField(offset), b.getPointerField(offset));
+      } else {
+        field<T>(offset);
+      }
+    }
+
+    template <typename G>
+    void group() { G::_visit(*this); }
+
+    template <typename G>
+    void unionGroup(uint discrimOffset, uint16_t value) {
+      if (!isActive(b, discrimOffset, value)) return;
+      bool saved = replaceOnly;
+      replaceOnly = replaceOnly || !isActive(a, discrimOffset, value);
+      G::_visit(*this);
+      replaceOnly = saved;
+    }
+
+  private:
+    DeltaWriter& writer;
+    _::StructReader a;
+    _::StructReader b;
+    bool replaceOnly = false;
+
+    static bool isActive(_::StructReader s, uint discrimOffset, uint16_t value) {
+      return s.getDataField<uint16_t>(discrimOffset * ELEMENTS) == value;
+    }
+  };
+
+  void header(DeltaOp op, size_t count, uint index) {
+    KJ_REQUIRE(count <= 0xffffff, "Delta op too large; the count has 24 bits.", count);
+    word w;
+    reinterpret_cast<_::WireValue<uint64_t>*>(&w)->set(
+        static_cast<uint64_t>(op) | static_cast<uint64_t>(count) << 8 |
+        static_cast<uint64_t>(index) << 32);
+    words.add(w);
+  }
+
+  size_t enter(DeltaOp op, uint index) {
+    header(op, 0, index);
+    return words.size();
+  }
+
+  void leave(size_t mark) {
+    // Drops the enter op again if nothing changed inside.
+    if (words.size() == mark) {
+      words.removeLast();
+    } else {
+      header(DeltaOp::LEAVE, 0, 0);
+    }
+  }
+
+  void diffData(Data::Reader a, Data::Reader b) {
+    if (a.size() == b.size() && memcmp(a.begin(), b.begin(), a.size()) == 0) return;
+
+    // Sections of different size (i.e. different schema versions) compare as zero-extended.
+    size_t count = kj::max(a.size(), b.size()) / sizeof(word);
+    size_t i = 0;
+    while (i < count) {
+      if (dataWord(a, i) == dataWord(b, i)) {
+        i++;
+        continue;
+      }
+      size_t start = i;
+      while (i < count && dataWord(a, i) != dataWord(b, i)) i++;
+      header(DeltaOp::DATA, i - start, start);
+      for (size_t j = start; j < i; j++) {
+        uint64_t value = dataWord(b, j);
+        word w;
+        memcpy(&w, &value, sizeof(w));
+        words.add(w);
+      }
+    }
+  }
+
+  static uint64_t dataWord(Data::Reader data, size_t index) {
+    // In message byte order, only compared and copied.
+    uint64_t result = 0;
+    if ((index + 1) * sizeof(word) <= data.size()) {
+      memcpy(&result, data.begin() + index * sizeof(word), sizeof(word));
+    }
+    return result;
+  }
+
+  static kj::Array<word> flatCopy(_::PointerReader value) {
+    MallocMessageBuilder message;
+    message.getRoot<AnyPointer>().set(AnyPointer::Reader(value));
+    return messageToFlatArray(message);
+  }
+
+  void set(uint index, kj::Array<word>&& flat) {
+    header(DeltaOp::SET, flat.size(), index);
+    words.addAll(flat);
+  }
+
+  void set(uint index, _::PointerReader value) { set(index, flatCopy(value)); }
+
+  void replace(uint index, _::PointerReader a, _::PointerReader b) {
+    if (!b.isNull()) {
+      set(index, b);
+    } else if (!a.isNull()) {
+      header(DeltaOp::CLEAR, 0, index);
+    }
+  }
+
+  template <typename T>
+  void diffElements(typename List<T>::Reader a, typename List<T>::Reader b) {
+    for (uint i = 0; i < b.size(); i++) {
+      auto elementA = a[i];
+      auto elementB = b[i];
+      size_t mark = enter(DeltaOp::ENTER_ELEMENT, i);
+      diffStruct<T>(ReaderImpl::asStruct(&elementA), ReaderImpl::asStruct(&elementB));
+      leave(mark);
+    }
+  }
+};
+
+template <typename T>
+struct DeltaWriter::PointerDiff<T, Kind::STRUCT> {
+  static void diff(DeltaWriter& writer, uint index, _::PointerReader a, _::PointerReader b) {
+    if (a.isNull() || b.isNull()) {
+      writer.replace(index, a, b);
+      return;
+    }
+    size_t mark = writer.enter(DeltaOp::ENTER, index);
+    writer.diffStruct<T>(a.getStruct(nullptr), b.getStruct(nullptr));
+    writer.leave(mark);
+  }
+};
+
+template <typename T, Kind k>
+struct DeltaWriter::PointerDiff {
+  // Blobs.
+  static void diff(DeltaWriter& writer, uint index, _::PointerReader a, _::PointerReader b) {
+    if (a.isNull() == b.isNull() &&
+        ValueEqual<T>::equal(_::PointerHelpers<T>::get(a), _::PointerHelpers<T>::get(b))) {
+      return;
+    }
+    writer.replace(index, a, b);
+  }
+};
+
+template <typename T>
+struct DeltaWriter::PointerDiff<List<T>, Kind::LIST>: public ListDiff<T> {};
+
+template <typename T, Kind k>
+struct DeltaWriter::ListDiff {
+  // Lists of anything but structs.
+  static void diff(DeltaWriter& writer, uint index, _::PointerReader a, _::PointerReader b) {
+    if (a.isNull() == b.isNull() &&
+        ValueEqual<List<T>>::equal(_::PointerHelpers<List<T>>::get(a),
+                                   _::PointerHelpers<List<T>>::get(b))) {
+      return;
+    }
+    writer.replace(index, a, b);
+  }
+};
+
+template <typename T>
+struct DeltaWriter::ListDiff<T, Kind::STRUCT> {
+  static void diff(DeltaWriter& writer, uint index, _::PointerReader a, _::PointerReader b) {
+    auto listA = _::PointerHelpers<List<T>>::get(a);
+    auto listB = _::PointerHelpers<List<T>>::get(b);
+    if (a.isNull() || b.isNull() || listA.size() != listB.size()) {
+      writer.replace(index, a, b);
+      return;
+    }
+    size_t mark = writer.enter(DeltaOp::ENTER_LIST, index);
+    writer.diffElements<T>(listA, listB);
+    writer.leave(mark);
+  }
+};
+
+template <>
+struct DeltaWriter::PointerDiff<AnyPointer, Kind::OTHER> {
+  // Compared by the bytes of a copy, so values copied into different layouts differ.
+  static void diff(DeltaWriter& writer, uint index, _::PointerReader a, _::PointerReader b) {
+    if (a.isNull() || b.isNull()) {
+      writer.replace(index, a, b);
+      return;
+    }
+    auto flatA = flatCopy(a);
+    auto flatB = flatCopy(b);
+    if (flatA.size() == flatB.size() &&
+        memcmp(flatA.begin(), flatB.begin(), flatA.size() * sizeof(word)) == 0) {
+      return;
+    }
+    writer.set(index, kj::mv(flatB));
+  }
+};
+
+template <typename T>
+struct DeltaWriter::PointerDiff<T, Kind::INTERFACE> {
+  static void diff(DeltaWriter&, uint, _::PointerReader, _::PointerReader) {}
+};
+
+template <typename T, Kind k>
+struct DeltaWriter::ValueEqual {
+  // Primitives, enums and blobs.
+  static bool equal(ReaderFor<T> a, ReaderFor<T> b) { return a == b; }
+};
+
+template <typename T>
+struct DeltaWriter::ValueEqual<T, Kind::STRUCT> {
+  static bool equal(typename T::Reader a, typename T::Reader b) {
+    DeltaWriter scratch;
+    scratch.diffStruct<T>(ReaderImpl::asStruct(&a), ReaderImpl::asStruct(&b));
+    return scratch.empty();
+  }
+};
+
+template <typename T>
+struct DeltaWriter::ValueEqual<List<T>, Kind::LIST> {
+  static bool equal(typename List<T>::Reader a, typename List<T>::Reader b) {
+    if (a.size() != b.size()) return false;
+    for (uint i = 0; i < a.size(); i++) {
+      if (!ValueEqual<T>::equal(a[i], b[i])) return false;
+    }
+    return true;
+  }
+};
+
+// ---------------------------------------------------------------------------------------
+
+class DeltaReader {
+public:
+  explicit DeltaReader(kj::ArrayPtr<const word> delta): pos(delta.begin()), end(delta.end()) {}
+
+  template <typename T>
+  void applyStruct(_::StructBuilder s) {
+    while (pos < end) {
+      Header h = next();
+      switch (h.op) {
+        case DeltaOp::DATA: {
+          KJ_REQUIRE(static_cast<size_t>(end - pos) >= h.count, "Delta is truncated.");
+          auto data = s.getDataSectionAsBlob();
+          for (uint i = 0; i < h.count; i++) {
+            // Words the builder's schema doesn't know about are dropped.
+            size_t offset = (h.index + i) * sizeof(word);
+            if (offset + sizeof(word) <= data.size()) {
+              memcpy(data.begin() + offset, pos + i, sizeof(word));
+            }
+          }
+          pos += h.count;
+          break;
+        }
+
+        case DeltaOp::SET: {
+          KJ_REQUIRE(static_cast<size_t>(end - pos) >= h.count, "Delta is truncated.");
+          if (h.index < s.getPointerSectionSize() / POINTERS) {
+            FlatArrayMessageReader message(kj::arrayPtr(pos, h.count));
+            AnyPointer::Builder(s.getPointerField(h.index)).set(message.getRoot<AnyPointer>());
+          }
+          pos += h.count;
+          break;
+        }
+
+        case DeltaOp::CLEAR:
+          if (h.index < s.getPointerSectionSize() / POINTERS) {
+            s.getPointerField(h.index).clear();
+          }
+          break;
+
+        case DeltaOp::ENTER:
+        case DeltaOp::ENTER_LIST: {
+          Visitor visitor(*this, s, h);
+          T::_visit(visitor);
+          KJ_REQUIRE(visitor.found, "Delta doesn't match the schema.");
+          break;
+        }
+
+        case DeltaOp::LEAVE:
+          return;
+
+        default:
+          KJ_FAIL_REQUIRE("Invalid delta op.", static_cast<uint>(h.op));
+      }
+    }
+  }
+
+private:
+  const word* pos;
+  const word* end;
+
+  struct Header {
+    DeltaOp op;
+    uint count;
+    uint index;
+  };
+
+  template <typename T, Kind k = kind<T>()>
+  struct Enter;
+  template <typename T, Kind k = kind<T>()>
+  struct EnterList;
+
+  class Visitor {
+    // Finds the type of the pointer an ENTER or ENTER_LIST op refers to.
+
+  public:
+    Visitor(DeltaReader& reader, _::StructBuilder s, Header h): reader(reader), s(s), h(h) {}
+
+    bool found = false;
+
+    template <typename T>
+    void field(uint offset) {
+      if (!found && offset == h.index) {
+        found = Enter<T>::apply(reader, s.getPointerField(offset), h.op);
+      }
+    }
+
+    template <typename T>
+    void unionField(uint offset, uint discrimOffset, uint16_t value) {
+      // Data comes first in a delta, so the builder already has the new discriminant.
+      if (isActive(discrimOffset, value)) field<T>(offset);
+    }
+
+    template <typename G>
+    void group() { G::_visit(*this); }
+
+    template <typename G>
+    void unionGroup(uint discrimOffset, uint16_t value) {
+      if (isActive(discrimOffset, value)) G::_visit(*this);
+    }
+
+  private:
+    DeltaReader& reader;
+    _::StructBuilder s;
+    Header h;
+
+    bool isActive(uint discrimOffset, uint16_t value) {
+      return s.getDataField<uint16_t>(discrimOffset * ELEMENTS) == value;
+    }
+  };
+
+  Header next() {
+    uint64_t value = reinterpret_cast<const _::WireValue<uint64_t>*>(pos++)->get();
+    return Header { static_cast<DeltaOp>(value & 0xff),
+                    static_cast<uint>(value >> 8 & 0xffffff),
+                    static_cast<uint>(value >> 32) };
+  }
+
+  template <typename T>
+  void applyElements(_::ListBuilder list) {
+    while (pos < end) {
+      Header h = next();
+      if (h.op == DeltaOp::LEAVE) return;
+      KJ_REQUIRE(h.op == DeltaOp::ENTER_ELEMENT && h.index < list.size() / ELEMENTS,
+                 "Invalid delta list element.");
+      applyStruct<T>(list.getStructElement(h.index * ELEMENTS));
+    }
+  }
+};
+
+template <typename T, Kind k>
+struct DeltaReader::Enter {
+  static bool apply(DeltaReader&, _::PointerBuilder, DeltaOp) { return false; }
+};
+
+template <typename T>
+struct DeltaReader::Enter<T, Kind::STRUCT> {
+  static bool apply(DeltaReader& reader, _::PointerBuilder ptr, DeltaOp op) {
+    if (op != DeltaOp::ENTER) return false;
+    reader.applyStruct<T>(ptr.getStruct(_::StructSize_<T>::value, nullptr));
+    return true;
+  }
+};
+
+template <typename T>
+struct DeltaReader::Enter<List<T>, Kind::LIST>: public EnterList<T> {};
+
+template <typename T, Kind k>
+struct DeltaReader::EnterList {
+  static bool apply(DeltaReader&, _::PointerBuilder, DeltaOp) { return false; }
+};
+
+template <typename T>
+struct DeltaReader::EnterList<T, Kind::STRUCT> {
+  static bool apply(DeltaReader& reader, _::PointerBuilder ptr, DeltaOp op) {
+    if (op != DeltaOp::ENTER_LIST) return false;
+    reader.applyElements<T>(ptr.getStructList(_::StructSize_<T>::value, nullptr));
+    return true;
+  }
+};
+
+// ---------------------------------------------------------------------------------------
+
+template <typename T>
+kj::Array<word> diff(Reader<T> oldValue, Reader<T> newValue) {
+  // Returns a delta which turns `oldValue` into `newValue`; empty if they are equal.
+  DeltaWriter writer;
+  writer.diffStruct<T>(ReaderImpl::asStruct(&oldValue), ReaderImpl::asStruct(&newValue));
+  return writer.finish();
+}
+
+template <typename T>
+void applyDelta(Builder<T> value, kj::ArrayPtr<const word> delta) {
+  // `value` must be equal to the old value the delta was computed from.
+  DeltaReader reader(delta);
+  reader.applyStruct<T>(BuilderImpl::asStruct(&value));
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_DELTA_H_
@@ -0,0 +1,238 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_EXECUTOR_H_
+#define CAPNP_ALTCXX_EXECUTOR_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <kj/async-io.h>
+#include <kj/debug.h>
+#include <kj/function.h>
+
+namespace capnp {
+namespace altcxx {
+
+class ThreadPoolExecutor: private kj::TaskSet::ErrorHandler {
+  // Runs calls of methods annotated with $executor on a pool of threads, so they don't hold up
+  // the event loop that received them.  Create one on the event loop thread, giving it the name
+  // used in the annotations; generated dispatch code looks it up by that name on the thread
+  // handling the call, and runs the method in place if there's none.
+  //
+  // Each worker has an event loop of its own.  The method is called there and the promise it
+  // returns is waited for, then the outcome is passed back to the calling loop through a pipe.
+  // Methods run this way get their params and results as usual -- both are set up on the calling
+  // loop before the method starts -- but must not use the context for anything else (such as
+  // releaseParams() or tailCall()), nor make calls on capabilities, which belong to the calling
+  // loop.
+  //
+  // If a call is canceled while its method is running, the calling loop waits for the method to
+  // return before releasing the call's messages.  The executor must outlive the calls it runs
+  // and must be destroyed on the thread that created it.
+
+public:
+  ThreadPoolExecutor(kj::LowLevelAsyncIoProvider& provider, kj::StringPtr name,
+                     uint threadCount = std::max(1u, std::thread::hardware_concurrency()))
+      : name(kj::heapString(name)), tasks(*this), next(threadExecutors()) {
+    int fds[2];
+    KJ_SYSCALL(pipe2(fds, O_CLOEXEC | O_NONBLOCK));
+    completionWrite = kj::AutoCloseFd(fds[1]);
+    completionRead = provider.wrapInputFd(fds[0],
+        kj::LowLevelAsyncIoProvider::TAKE_OWNERSHIP |
+        kj::LowLevelAsyncIoProvider::ALREADY_CLOEXEC |
+        kj::LowLevelAsyncIoProvider::ALREADY_NONBLOCK);
+    tasks.add(receiveCompletions());
+
+    for (uint i = 0; i < std::max(1u, threadCount); i++) {
+      threads.emplace_back([this]() { workerLoop(); });
+    }
+    threadExecutors() = this;
+  }
+
+  ~ThreadPoolExecutor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread: threads) {
+      thread.join();
+    }
+
+    ThreadPoolExecutor** link = &threadExecutors();
+    while (*link != this) link = &(*link)->next;
+    *link = next;
+  }
+
+  KJ_DISALLOW_COPY(ThreadPoolExecutor);
+
+  kj::StringPtr getName() const { return name; }
+
+  template <typename Func>
+  kj::Promise<void> run(Func&& func) {
+    // Calls func() on one of the pool's threads; func returns kj::Promise<void>.
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    auto job = kj::heap<Job>(*this, kj::fwd<Func>(func), kj::mv(paf.fulfiller));
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(job.get());
+    }
+    wake.notify_one();
+    return paf.promise.then(kj::mvCapture(job, [](kj::Own<Job>&&) {}));
+  }
+
+  static kj::Maybe<ThreadPoolExecutor&> find(kj::StringPtr name) {
+    // The executor of the given name created on this thread, if any.
+    for (ThreadPoolExecutor* executor = threadExecutors(); executor != nullptr;
+         executor = executor->next) {
+      if (executor->name == name) return *executor;
+    }
+    return nullptr;
+  }
+
+  template <typename Context, typename Func>
+  static kj::Promise<void> dispatch(kj::StringPtr name, Context& context, Func&& func) {
+    // Used by generated code.  The params and results are set up here, before handing off:  over
+    // RPC, reading the params and allocating the results go through the connection, which
+    // belongs to this loop.
+    KJ_IF_MAYBE(executor, find(name)) {
+      context.getParams();
+      context.getResults();
+      return executor->run(kj::fwd<Func>(func));
+    }
+    return func();
+  }
+
+private:
+  struct Job {
+    enum State { QUEUED, RUNNING, DONE, DELIVERED };
+
+    ThreadPoolExecutor& executor;
+    kj::Function<kj::Promise<void>()> func;
+    kj::Own<kj::PromiseFulfiller<void>> fulfiller;
+    kj::Maybe<kj::Exception> exception;
+    State state = QUEUED;
+
+    template <typename Func>
+    Job(ThreadPoolExecutor& executor, Func&& func, kj::Own<kj::PromiseFulfiller<void>> fulfiller)
+        : executor(executor), func(kj::fwd<Func>(func)), fulfiller(kj::mv(fulfiller)) {}
+
+    ~Job() { executor.forget(*this); }
+  };
+
+  kj::String name;
+  kj::AutoCloseFd completionWrite;
+  kj::Own<kj::AsyncInputStream> completionRead;
+  kj::byte completionBuffer[64];
+  kj::TaskSet tasks;
+  ThreadPoolExecutor* next;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable jobFinished;
+  std::deque<Job*> queue;
+  std::vector<Job*> completed;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+
+  static ThreadPoolExecutor*& threadExecutors() {
+    static thread_local ThreadPoolExecutor* head = nullptr;
+    return head;
+  }
+
+  void workerLoop() {
+    kj::EventLoop loop;
+    kj::WaitScope waitScope(loop);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      Job* job = queue.front();
+      queue.pop_front();
+      job->state = Job::RUNNING;
+      lock.unlock();
+
+      auto exception = kj::runCatchingExceptions([&]() { job->func().wait(waitScope); });
+
+      lock.lock();
+      job->exception = kj::mv(exception);
+      job->state = Job::DONE;
+      completed.push_back(job);
+      jobFinished.notify_all();
+
+      // A full pipe already has a wakeup pending.
+      kj::byte signal = 0;
+      KJ_NONBLOCKING_SYSCALL(write(completionWrite, &signal, 1));
+    }
+  }
+
+  kj::Promise<void> receiveCompletions() {
+    return completionRead->tryRead(completionBuffer, 1, sizeof(completionBuffer))
+        .then([this](size_t) {
+      std::vector<Job*> done;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(completed);
+        for (Job* job: done) job->state = Job::DELIVERED;
+      }
+      for (Job* job: done) {
+        KJ_IF_MAYBE(exception, job->exception) {
+          job->fulfiller->reject(kj::mv(*exception));
+        } else {
+          job->fulfiller->fulfill();
+        }
+      }
+      return receiveCompletions();
+    });
+  }
+
+  void forget(Job& job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (job.state == Job::QUEUED) {
+      queue.erase(std::find(queue.begin(), queue.end(), &job));
+      return;
+    }
+    // The method may still be using the call's messages.
+    jobFinished.wait(lock, [&]() { return job.state != Job::RUNNING; });
+    if (job.state == Job::DONE) {
+      completed.erase(std::find(completed.begin(), completed.end(), &job));
+    }
+  }
+
+  void taskFailed(kj::Exception&& exception) override {
+    KJ_LOG(ERROR, "executor stopped receiving completions", name, exception);
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_EXECUTOR_H_
@@ -27,5 +27,9 @@
 #include "property.h"
 #include "property-pipeline.h"
 #include "impl-pipeline.h"
+#include "native.h"
+#include "value.h"
+#include "projection.h"
+#include "text.h"
 
 #endif // CAPNP_ALTCXX_GENERATED_HEADER_SUPPORT_H_
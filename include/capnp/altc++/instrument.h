@@ -0,0 +1,214 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_INSTRUMENT_H_
+#define CAPNP_ALTCXX_INSTRUMENT_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <kj/array.h>
+#include <kj/async.h>
+#include <kj/string.h>
+
+namespace capnp {
+namespace altcxx {
+
+class MethodStats {
+  // Call statistics of one method of an interface annotated with $instrument.  Generated
+  // dispatch code keeps one of these per method and passes every call through track().
+  //
+  // Counters are sharded by thread, so threads serving calls at the same time rarely touch the
+  // same cache lines; updates are relaxed atomic increments and never take a lock.  Latencies go
+  // to a histogram with two buckets per power of two nanoseconds, i.e. within 50% of the actual
+  // value, from 1ns to a few seconds.
+
+public:
+  static constexpr uint BUCKET_COUNT = 64;
+
+  struct Snapshot {
+    uint64_t interfaceId;
+    uint16_t methodId;
+    kj::StringPtr name;
+    uint64_t calls;       // Started.
+    uint64_t inFlight;    // Started, but not finished yet.
+    uint64_t latencyCounts[BUCKET_COUNT];
+
+    uint64_t percentile(double fraction) const {
+      // Upper bound, in nanoseconds, of the latency of the given fraction of finished calls.
+      uint64_t finished = calls - inFlight;
+      uint64_t target = finished * fraction;
+      uint64_t seen = 0;
+      for (uint i = 0; i < BUCKET_COUNT; i++) {
+        seen += latencyCounts[i];
+        if (seen > target || (seen == finished && seen > 0)) return bucketLimit(i);
+      }
+      return 0;
+    }
+  };
+
+  MethodStats(uint64_t interfaceId, uint16_t methodId, kj::StringPtr name)
+      : interfaceId(interfaceId), methodId(methodId), name(name) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().methods.push_back(this);
+  }
+
+  ~MethodStats() {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    auto& methods = registry().methods;
+    methods.erase(std::find(methods.begin(), methods.end(), this));
+  }
+
+  KJ_DISALLOW_COPY(MethodStats);
+
+  template <typename Func>
+  kj::Promise<void> track(Func&& func) {
+    auto call = kj::heap<Call>(*this);
+    Call& ref = *call;
+    kj::Promise<void> promise = nullptr;
+    try {
+      promise = func();
+    } catch (...) {
+      ref.finish();
+      throw;
+    }
+    return promise.then([&ref]() { ref.finish(); },
+                        [&ref](kj::Exception&& exception) {
+      ref.finish();
+      kj::throwFatalException(kj::mv(exception));
+    }).then(kj::mvCapture(call, [](kj::Own<Call>&&) {}));
+  }
+
+  Snapshot snapshot() const {
+    Snapshot result;
+    result.interfaceId = interfaceId;
+    result.methodId = methodId;
+    result.name = name;
+    uint64_t finished = 0;
+    result.calls = 0;
+    for (uint i = 0; i < BUCKET_COUNT; i++) result.latencyCounts[i] = 0;
+    for (auto& shard: shards) {
+      // Read finished counts first, so a call finishing meanwhile is never counted as finished
+      // without being counted as started.
+      for (uint i = 0; i < BUCKET_COUNT; i++) {
+        uint64_t count = shard.latencyCounts[i].load(std::memory_order_acquire);
+        result.latencyCounts[i] += count;
+        finished += count;
+      }
+      result.calls += shard.calls.load(std::memory_order_acquire);
+    }
+    result.inFlight = result.calls > finished ? result.calls - finished : 0;
+    return result;
+  }
+
+  static kj::Array<Snapshot> snapshotAll() {
+    // Snapshots of every instrumented method in the process.
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    auto result = kj::heapArrayBuilder<Snapshot>(registry().methods.size());
+    for (auto method: registry().methods) {
+      result.add(method->snapshot());
+    }
+    return result.finish();
+  }
+
+  static uint bucketFor(uint64_t nanos) {
+    if (nanos < 2) return nanos;
+    uint log = 63 - __builtin_clzll(nanos);
+    uint bucket = log * 2 + ((nanos >> (log - 1)) & 1);
+    return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+  }
+
+  static uint64_t bucketLimit(uint bucket) {
+    // Smallest latency past the bucket.
+    if (bucket < 1) return 1;
+    if (bucket + 1 >= BUCKET_COUNT) return UINT64_MAX;
+    uint next = bucket + 1;
+    uint log = next / 2;
+    return (uint64_t(1) << log) + (next % 2) * (uint64_t(1) << (log - 1));
+  }
+
+private:
+  static constexpr uint SHARD_COUNT = 8;
+  typedef std::chrono::steady_clock Clock;
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> latencyCounts[BUCKET_COUNT];
+
+    Shard() {
+      for (auto& count: latencyCounts) count.store(0, std::memory_order_relaxed);
+    }
+  };
+
+  struct Registry {
+    std::mutex mutex;
+    std::vector<MethodStats*> methods;
+  };
+
+  struct Call {
+    MethodStats& stats;
+    Shard& shard;
+    Clock::time_point start;
+    bool done = false;
+
+    explicit Call(MethodStats& stats)
+        : stats(stats), shard(stats.shards[threadShard()]), start(Clock::now()) {
+      shard.calls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~Call() { finish(); }  // Also counts canceled calls.
+
+    void finish() {
+      if (done) return;
+      done = true;
+      uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now() - start).count();
+      shard.latencyCounts[bucketFor(nanos)].fetch_add(1, std::memory_order_release);
+    }
+  };
+
+  uint64_t interfaceId;
+  uint16_t methodId;
+  kj::StringPtr name;
+  Shard shards[SHARD_COUNT];
+
+  static Registry& registry() {
+    static Registry result;
+    return result;
+  }
+
+  static uint threadShard() {
+    static std::atomic<uint> nextShard(0);
+    static thread_local uint shard = nextShard.fetch_add(1, std::memory_order_relaxed) %
+                                     SHARD_COUNT;
+    return shard;
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_INSTRUMENT_H_
@@ -0,0 +1,173 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_LIST_INDEX_H_
+#define CAPNP_ALTCXX_LIST_INDEX_H_
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <kj/array.h>
+#include <kj/debug.h>
+#include <capnp/list.h>
+
+namespace capnp {
+namespace altcxx {
+
+template <typename Class, typename Property>
+class FieldKey {
+  // Extracts the value of a property, given as a pointer to member, e.g.
+  // `fieldKey(&Person::Reader::id)`.
+
+public:
+  explicit FieldKey(Property Class::* member): member(member) {}
+
+  template <typename R>
+  auto operator()(R reader) const -> decltype((reader.*(this->member)).get()) {
+    return (reader.*member).get();
+  }
+
+private:
+  Property Class::* member;
+};
+
+template <typename Class, typename Property>
+FieldKey<Class, Property> fieldKey(Property Class::* member) {
+  return FieldKey<Class, Property>(member);
+}
+
+template <typename T, typename KeyFunc>
+class ListIndex {
+  // An index over a List(T), ordered by the key `KeyFunc` extracts from each element.  Elements
+  // aren't copied; the index holds the order of their positions, and lookups binary search over
+  // the list itself.  That order can be stored in a message next to the list (see writeOrder())
+  // and read from there later without sorting or copying; its entries are then checked as
+  // lookups reach them.
+
+public:
+  typedef typename List<T>::Reader ListReader;
+  typedef decltype(kj::instance<KeyFunc&>()(kj::instance<typename T::Reader>())) Key;
+
+  ListIndex(ListReader list, KeyFunc key)
+      : list(list), key(kj::mv(key)), ownedOrder(sortedOrder(list, this->key)) {}
+
+  ListIndex(ListReader list, KeyFunc key, List<uint32_t>::Reader storedOrder)
+      : list(list), key(kj::mv(key)), storedOrder(storedOrder), stored(true) {
+    KJ_REQUIRE(storedOrder.size() == list.size(), "Stored order doesn't match the list.");
+  }
+
+  uint size() const { return list.size(); }
+
+  uint32_t getPosition(uint position) const {
+    // Index in the list of the element at `position` in key order.
+    if (!stored) return ownedOrder[position];
+    uint32_t result = storedOrder[position];
+    KJ_REQUIRE(result < list.size(), "Stored order doesn't match the list.");
+    return result;
+  }
+
+  typename T::Reader operator[](uint position) const {
+    // The element at `position` in key order.
+    return list[getPosition(position)];
+  }
+
+  uint lowerBound(const Key& value) const {
+    // Position of the first element whose key isn't less than `value`.
+    uint begin = 0;
+    uint end = size();
+    while (begin < end) {
+      uint mid = begin + (end - begin) / 2;
+      if (keyAt(mid) < value) {
+        begin = mid + 1;
+      } else {
+        end = mid;
+      }
+    }
+    return begin;
+  }
+
+  std::pair<uint, uint> equalRange(const Key& value) const {
+    // Positions [first, second) of the elements whose key equals `value`.
+    uint first = lowerBound(value);
+    uint last = first;
+    while (last < size() && !(value < keyAt(last))) last++;
+    return std::make_pair(first, last);
+  }
+
+  kj::Maybe<typename T::Reader> find(const Key& value) const {
+    uint position = lowerBound(value);
+    if (position < size() && !(value < keyAt(position))) {
+      return (*this)[position];
+    }
+    return nullptr;
+  }
+
+  void writeOrder(List<uint32_t>::Builder builder) const {
+    // `builder` must have the same size as the list.
+    for (uint i = 0; i < size(); i++) {
+      builder.set(i, getPosition(i));
+    }
+  }
+
+private:
+  ListReader list;
+  KeyFunc key;
+  kj::Array<uint32_t> ownedOrder;
+  List<uint32_t>::Reader storedOrder;
+  bool stored = false;
+
+  Key keyAt(uint position) const {
+    return key((*this)[position]);
+  }
+
+  static kj::Array<uint32_t> sortedOrder(ListReader list, const KeyFunc& key) {
+    // Keys are extracted once and sorted along with positions, to avoid touching elements
+    // O(n log n) times.
+    std::vector<std::pair<Key, uint32_t>> entries;
+    entries.reserve(list.size());
+    for (uint i = 0; i < list.size(); i++) {
+      entries.emplace_back(key(list[i]), i);
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const std::pair<Key, uint32_t>& a, const std::pair<Key, uint32_t>& b) {
+          return a.first < b.first;
+        });
+
+    auto result = kj::heapArray<uint32_t>(entries.size());
+    for (uint i = 0; i < entries.size(); i++) {
+      result[i] = entries[i].second;
+    }
+    return result;
+  }
+};
+
+template <typename T, typename KeyFunc>
+ListIndex<T, KeyFunc> indexBy(typename List<T>::Reader list, KeyFunc key) {
+  return ListIndex<T, KeyFunc>(list, kj::mv(key));
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_LIST_INDEX_H_
@@ -0,0 +1,167 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_LIST_SORT_H_
+#define CAPNP_ALTCXX_LIST_SORT_H_
+
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include <kj/debug.h>
+#include <capnp/list.h>
+#include "impl.h"
+#include "list-index.h"
+
+namespace capnp {
+namespace altcxx {
+
+template <typename KeyFunc>
+class KeyLess {
+  // Orders struct readers by the key `KeyFunc` extracts, e.g.
+  // `compareBy(fieldKey(&Person::Reader::name))`.
+
+public:
+  explicit KeyLess(KeyFunc key): key(kj::mv(key)) {}
+
+  template <typename R>
+  bool operator()(R a, R b) const { return key(a) < key(b); }
+
+private:
+  KeyFunc key;
+};
+
+template <typename KeyFunc>
+KeyLess<KeyFunc> compareBy(KeyFunc key) {
+  return KeyLess<KeyFunc>(kj::mv(key));
+}
+
+inline void moveStructPointers(word* to, const word* from, uint count, int32_t distance) {
+  // Copies `count` pointers which are moving `distance` words back, adjusting the offsets of
+  // struct and list pointers.  Their targets stay where they are; far and capability pointers
+  // are absolute.
+
+  for (uint i = 0; i < count; i++) {
+    ::capnp::_::WireValue<uint32_t> halves[2];
+    memcpy(halves, from + i, sizeof(word));
+    uint32_t lower = halves[0].get();
+    uint32_t upper = halves[1].get();
+    uint32_t kind = lower & 3;
+    // A struct pointer to a target right behind it has a lower half of 0; only null pointers
+    // and zero-sized structs, whose offsets mean nothing, are left alone.
+    bool emptyStruct = kind == 0 && upper == 0;
+    if ((lower != 0 || upper != 0) && kind <= 1 && !emptyStruct) {
+      int32_t offset = static_cast<int32_t>(lower) >> 2;
+      halves[0].set((static_cast<uint32_t>(offset + distance) << 2) | kind);
+    }
+    memcpy(to + i, halves, sizeof(word));
+  }
+}
+
+template <typename T, typename KeyFunc>
+void sortBy(typename List<T>::Builder list, KeyFunc key) {
+  // Stable in-place sort of a struct list by key.  Elements are moved as raw data and pointer
+  // sections, fixing up relative pointers, so nothing they point to is copied or re-encoded.
+
+  uint size = list.size();
+  if (size < 2) return;
+
+  auto reader = list.asReader();
+  typedef decltype(key(reader[0])) Key;
+  std::vector<std::pair<Key, uint>> order;
+  order.reserve(size);
+  for (uint i = 0; i < size; i++) {
+    order.emplace_back(key(reader[i]), i);
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [](const std::pair<Key, uint>& a, const std::pair<Key, uint>& b) {
+        return a.first < b.first;
+      });
+
+  // Elements are laid out back to back, each being its data section followed by its pointers.
+  auto first = list[0];
+  auto second = list[1];
+  word* begin = reinterpret_cast<word*>(
+      BuilderImpl::asStruct(&first).getDataSectionAsBlob().begin());
+  size_t stride = reinterpret_cast<word*>(
+      BuilderImpl::asStruct(&second).getDataSectionAsBlob().begin()) - begin;
+  size_t dataWords = BuilderImpl::asStruct(&first).getDataSectionAsBlob().size() / sizeof(word);
+  uint pointerCount = stride - dataWords;
+
+  auto original = kj::heapArray<word>(begin, size * stride);
+  for (uint i = 0; i < size; i++) {
+    uint from = order[i].second;
+    if (from == i) continue;
+    const word* source = original.begin() + from * stride;
+    word* target = begin + i * stride;
+    memcpy(target, source, dataWords * sizeof(word));
+    moveStructPointers(target + dataWords, source + dataWords, pointerCount,
+      (static_cast<int32_t>(from) - static_cast<int32_t>(i)) * static_cast<int32_t>(stride));
+  }
+}
+
+template <typename T, typename KeyFunc>
+void mergeBy(typename List<T>::Builder output, kj::ArrayPtr<const typename List<T>::Reader> inputs,
+             KeyFunc key) {
+  // Merges lists already sorted by key into `output`, which must have room for all of their
+  // elements.  Equal keys are taken from earlier inputs first.
+
+  typedef decltype(key(inputs[0][0])) Key;
+  struct Head {
+    Key key;
+    uint input;
+    uint index;
+
+    bool operator<(const Head& other) const {
+      // std::priority_queue pops the largest.
+      if (other.key < key) return true;
+      if (key < other.key) return false;
+      return input > other.input;
+    }
+  };
+
+  std::priority_queue<Head> heads;
+  for (uint i = 0; i < inputs.size(); i++) {
+    if (inputs[i].size() > 0) {
+      heads.push(Head { key(inputs[i][0]), i, 0 });
+    }
+  }
+
+  uint position = 0;
+  while (!heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+    auto& input = inputs[head.input];
+    KJ_REQUIRE(position < output.size(), "Output list is too small for the merge.");
+    output.setWithCaveats(position++, input[head.index]);
+    if (++head.index < input.size()) {
+      heads.push(Head { key(input[head.index]), head.input, head.index });
+    }
+  }
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_LIST_SORT_H_
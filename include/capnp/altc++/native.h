@@ -0,0 +1,145 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_NATIVE_H_
+#define CAPNP_ALTCXX_NATIVE_H_
+
+#include <string.h>
+#include <kj/array.h>
+#include <kj/memory.h>
+#include <kj/string.h>
+#include "impl.h"
+
+namespace capnp {
+namespace altcxx {
+
+// Support for the plain C++ mirrors generated for structs annotated with $mirror.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static constexpr bool WIRE_BYTE_ORDER = true;
+#else
+static constexpr bool WIRE_BYTE_ORDER = false;
+#endif
+// True if primitives are stored in memory the same way as in a message, in which case a mirror
+// whose data members follow the data section layout can be filled with a single copy.
+
+inline void copyDataSection(_::StructReader from, void* to, size_t size) {
+  auto data = from.getDataSectionAsBlob();
+  size_t copied = kj::min(data.size(), size);
+  memcpy(to, data.begin(), copied);
+  memset(reinterpret_cast<byte*>(to) + copied, 0, size - copied);
+}
+
+inline void copyDataSection(const void* from, _::StructBuilder to, size_t size) {
+  auto data = to.getDataSectionAsBlob();
+  memcpy(data.begin(), from, kj::min(data.size(), size));
+}
+
+template <typename T, Kind k = kind<T>()>
+struct NativeCodec {
+  // Primitives and enums.
+  typedef T Type;
+
+  static Type decode(T value) { return value; }
+
+  static void setElement(typename List<T>::Builder& list, uint index, T value) {
+    list.set(index, value);
+  }
+};
+
+template <>
+struct NativeCodec<Text, Kind::BLOB> {
+  typedef kj::String Type;
+
+  static Type decode(Text::Reader value) { return kj::heapString(value); }
+  static Text::Reader encode(const Type& value) { return Text::Reader(value.cStr(), value.size()); }
+
+  static void setElement(List<Text>::Builder& list, uint index, const Type& value) {
+    list.set(index, encode(value));
+  }
+};
+
+template <>
+struct NativeCodec<Data, Kind::BLOB> {
+  typedef kj::Array<byte> Type;
+
+  static Type decode(Data::Reader value) { return kj::heapArray<byte>(value); }
+  static Data::Reader encode(const Type& value) { return value.asPtr(); }
+
+  static void setElement(List<Data>::Builder& list, uint index, const Type& value) {
+    list.set(index, encode(value));
+  }
+};
+
+template <typename T>
+struct NativeCodec<T, Kind::STRUCT> {
+  typedef typename T::Native Type;
+
+  static Type decode(typename T::Reader value) {
+    Type result;
+    value.copyTo(result);
+    return result;
+  }
+
+  template <typename Property>
+  static kj::Own<Type> decodeOwn(Property& property) {
+    // Struct fields are mirrored by pointer, null when the field is null.
+    if (property.isNull()) return nullptr;
+    auto result = kj::heap<Type>();
+    property.asReader().copyTo(*result);
+    return kj::mv(result);
+  }
+
+  static void setElement(typename List<T>::Builder& list, uint index, const Type& value) {
+    list[index].copyFrom(value);
+  }
+};
+
+template <typename T>
+struct NativeCodec<List<T>, Kind::LIST> {
+  typedef kj::Array<typename NativeCodec<T>::Type> Type;
+
+  static Type decode(typename List<T>::Reader value) {
+    auto builder = kj::heapArrayBuilder<typename NativeCodec<T>::Type>(value.size());
+    for (uint i = 0; i < value.size(); i++) {
+      builder.add(NativeCodec<T>::decode(value[i]));
+    }
+    return builder.finish();
+  }
+
+  static void fill(typename List<T>::Builder list, const Type& value) {
+    for (uint i = 0; i < value.size(); i++) {
+      NativeCodec<T>::setElement(list, i, value[i]);
+    }
+  }
+
+  static void setElement(typename List<List<T>>::Builder& list, uint index, const Type& value) {
+    fill(list.init(index, value.size()), value);
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_NATIVE_H_
@@ -0,0 +1,367 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_PACKED_H_
+#define CAPNP_ALTCXX_PACKED_H_
+
+#include <string.h>
+#include <kj/array.h>
+#include <kj/debug.h>
+#include <kj/io.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define CAPNP_ALTCXX_PACKED_SIMD 1
+#else
+#define CAPNP_ALTCXX_PACKED_SIMD 0
+#endif
+
+namespace capnp {
+namespace altcxx {
+
+// Implementation of the packed encoding producing byte for byte the same output as the streams
+// in <capnp/serialize-packed.h>.  When built with SSSE3 enabled (e.g. -mssse3 or -march=native
+// on any x86-64 from the last decade), tags are computed with one compare per word and bytes
+// are moved with a single shuffle instead of eight conditional copies.
+
+class PackedCodec {
+public:
+  static constexpr size_t MAX_RUN = 255;
+  // Maximum number of words following a zero or all-nonzero word that one count byte covers.
+
+  static size_t maxPackedSize(size_t words) {
+    // Upper bound of the packed size of `words` words, when packed as one piece.
+    return words * 10;
+  }
+
+  static byte* pack(const word*& in, const word* stop, const word* end, byte* out) {
+    // Packs words from `in` up to at least `stop`, advancing `in`.  Runs may continue past
+    // `stop` up to `end`, so packing a piece in several steps produces the same output as
+    // packing it at once.  `out` needs room for maxPackedSize(stop - in) + MAX_RUN words.
+
+    while (in < stop) {
+      byte* tagPos = out++;
+      uint8_t tag = packWord(in++, out);
+      *tagPos = tag;
+
+      if (tag == 0) {
+        // A zero word is followed by the number of zero words after it.
+        const word* limit = end - in > ptrdiff_t(MAX_RUN) ? in + MAX_RUN : end;
+        const word* run = in;
+        while (in < limit && nonzeroTag(in) == 0) ++in;
+        *out++ = in - run;
+      } else if (tag == 0xff) {
+        // A word with no zero bytes is followed by the number of words copied verbatim after
+        // it, which are all those with at most one zero byte, since packing them would not
+        // save anything.
+        const word* limit = end - in > ptrdiff_t(MAX_RUN) ? in + MAX_RUN : end;
+        const word* run = in;
+        while (in < limit && zeroCount(nonzeroTag(in)) < 2) ++in;
+        size_t count = in - run;
+        *out++ = count;
+        memcpy(out, run, count * sizeof(word));
+        out += count * sizeof(word);
+      }
+    }
+    return out;
+  }
+
+  static const byte* unpackWord(uint8_t tag, const byte* in, word* out) {
+    // Expands the bytes following `tag` into `out`.  With SIMD enabled, 8 bytes at `in` must
+    // be readable regardless of how many the tag uses.
+
+#if CAPNP_ALTCXX_PACKED_SIMD
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+    __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(tables().expand[tag]));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(bytes, shuffle));
+    return in + 8 - zeroCount(tag);
+#else
+    byte* outBytes = reinterpret_cast<byte*>(out);
+    for (uint i = 0; i < sizeof(word); i++) {
+      outBytes[i] = (tag >> i) & 1 ? *in++ : 0;
+    }
+    return in;
+#endif
+  }
+
+  static uint8_t zeroCount(uint8_t tag) {
+    static const uint8_t ZERO_COUNT[256] = {
+#define Z1(n) 8 - (n), 7 - (n)
+#define Z2(n) Z1(n), Z1(n + 1)
+#define Z3(n) Z2(n), Z2(n + 1)
+#define Z4(n) Z3(n), Z3(n + 1)
+#define Z5(n) Z4(n), Z4(n + 1)
+#define Z6(n) Z5(n), Z5(n + 1)
+#define Z7(n) Z6(n), Z6(n + 1)
+#define Z8(n) Z7(n), Z7(n + 1)
+      Z8(0)
+#undef Z1
+#undef Z2
+#undef Z3
+#undef Z4
+#undef Z5
+#undef Z6
+#undef Z7
+#undef Z8
+    };
+    return ZERO_COUNT[tag];
+  }
+
+private:
+
+#if CAPNP_ALTCXX_PACKED_SIMD
+  struct Tables {
+    alignas(16) uint8_t compress[256][16];
+    alignas(16) uint8_t expand[256][16];
+
+    Tables() {
+      for (uint tag = 0; tag < 256; tag++) {
+        memset(compress[tag], 0x80, 16);
+        memset(expand[tag], 0x80, 16);
+        uint8_t next = 0;
+        for (uint8_t i = 0; i < 8; i++) {
+          if ((tag >> i) & 1) {
+            compress[tag][next] = i;
+            expand[tag][i] = next++;
+          }
+        }
+      }
+    }
+  };
+
+  static const Tables& tables() {
+    static const Tables result;
+    return result;
+  }
+
+  static uint8_t nonzeroTag(const word* in) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+  }
+
+  static uint8_t packWord(const word* in, byte*& out) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+    uint8_t tag = ~_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+    __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(tables().compress[tag]));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(bytes, shuffle));
+    out += 8 - zeroCount(tag);
+    return tag;
+  }
+#else
+  static uint8_t nonzeroTag(const word* in) {
+    const byte* bytes = reinterpret_cast<const byte*>(in);
+    uint8_t tag = 0;
+    for (uint i = 0; i < sizeof(word); i++) {
+      tag |= (bytes[i] != 0) << i;
+    }
+    return tag;
+  }
+
+  static uint8_t packWord(const word* in, byte*& out) {
+    const byte* bytes = reinterpret_cast<const byte*>(in);
+    uint8_t tag = 0;
+    for (uint i = 0; i < sizeof(word); i++) {
+      uint8_t bit = bytes[i] != 0;
+      *out = bytes[i];
+      out += bit;
+      tag |= bit << i;
+    }
+    return tag;
+  }
+#endif
+};
+
+class PackedOutputStream: public kj::OutputStream {
+  // Drop-in for capnp::_::PackedOutputStream.  Packs straight into the buffer of `inner` when
+  // it has room, and through a scratch buffer otherwise.
+
+public:
+  explicit PackedOutputStream(kj::BufferedOutputStream& inner): inner(inner) {}
+  KJ_DISALLOW_COPY(PackedOutputStream);
+
+  void write(const void* src, size_t size) override {
+    KJ_REQUIRE(size % sizeof(word) == 0, "PackedOutputStream writes must be word-aligned.");
+
+    const word* in = reinterpret_cast<const word*>(src);
+    const word* end = in + size / sizeof(word);
+    while (in < end) {
+      const word* stop = end - in > ptrdiff_t(CHUNK_WORDS) ? in + CHUNK_WORDS : end;
+      size_t bound = PackedCodec::maxPackedSize(stop - in + PackedCodec::MAX_RUN);
+
+      auto buffer = inner.getWriteBuffer();
+      byte* out;
+      if (buffer.size() >= bound) {
+        out = buffer.begin();
+      } else {
+        if (scratch == nullptr) {
+          scratch = kj::heapArray<byte>(
+              PackedCodec::maxPackedSize(CHUNK_WORDS + PackedCodec::MAX_RUN));
+        }
+        out = scratch.begin();
+      }
+
+      byte* outEnd = PackedCodec::pack(in, stop, end, out);
+      inner.write(out, outEnd - out);
+    }
+  }
+
+private:
+  static constexpr size_t CHUNK_WORDS = 1024;
+
+  kj::BufferedOutputStream& inner;
+  kj::Array<byte> scratch;
+};
+
+class PackedInputStream: public kj::InputStream {
+  // Drop-in for capnp::_::PackedInputStream.  Words are unpacked straight from the buffer of
+  // `inner`, falling back to reading byte by byte only for words split across its refills.
+
+public:
+  explicit PackedInputStream(kj::BufferedInputStream& inner): inner(inner) {}
+  KJ_DISALLOW_COPY(PackedInputStream);
+
+  size_t tryRead(void* dst, size_t minBytes, size_t maxBytes) override {
+    KJ_REQUIRE(minBytes % sizeof(word) == 0 && maxBytes % sizeof(word) == 0,
+               "PackedInputStream reads must be word-aligned.");
+
+    word* begin = reinterpret_cast<word*>(dst);
+    word* out = begin;
+    word* outMin = out + minBytes / sizeof(word);
+    word* outEnd = out + maxBytes / sizeof(word);
+
+    while (out < outMin) {
+      if (zeroRun > 0) {
+        size_t count = kj::min(zeroRun, size_t(outEnd - out));
+        memset(out, 0, count * sizeof(word));
+        out += count;
+        zeroRun -= count;
+        continue;
+      }
+      if (rawRun > 0) {
+        size_t count = kj::min(rawRun, size_t(outEnd - out));
+        inner.read(out, count * sizeof(word));
+        out += count;
+        rawRun -= count;
+        continue;
+      }
+
+      auto buffer = inner.tryGetReadBuffer();
+      if (buffer.size() == 0) break;
+
+      // A tag, up to eight bytes and a count fit in ten bytes.
+      const byte* in = buffer.begin();
+      while (out < outEnd && buffer.end() - in >= 10) {
+        uint8_t tag = *in++;
+        in = PackedCodec::unpackWord(tag, in, out++);
+        if (tag == 0) {
+          zeroRun = *in++;
+          break;
+        } else if (tag == 0xff) {
+          rawRun = *in++;
+          break;
+        }
+      }
+
+      if (in != buffer.begin()) {
+        inner.skip(in - buffer.begin());
+      } else {
+        readSplitWord(out++);
+      }
+    }
+
+    return (out - begin) * sizeof(word);
+  }
+
+private:
+  kj::BufferedInputStream& inner;
+  size_t zeroRun = 0;
+  size_t rawRun = 0;
+
+  void readSplitWord(word* out) {
+    uint8_t tag;
+    inner.read(&tag, 1);
+    byte bytes[8];
+    inner.read(bytes, 8 - PackedCodec::zeroCount(tag));
+    PackedCodec::unpackWord(tag, bytes, out);
+
+    if (tag == 0 || tag == 0xff) {
+      uint8_t count;
+      inner.read(&count, 1);
+      (tag == 0 ? zeroRun : rawRun) = count;
+    }
+  }
+};
+
+class PackedMessageReader: private PackedInputStream, public InputStreamMessageReader {
+public:
+  PackedMessageReader(kj::BufferedInputStream& inputStream,
+                      ReaderOptions options = ReaderOptions(),
+                      kj::ArrayPtr<word> scratchSpace = nullptr)
+      : PackedInputStream(inputStream),
+        InputStreamMessageReader(static_cast<PackedInputStream&>(*this), options, scratchSpace) {}
+};
+
+class PackedFdMessageReader: private kj::FdInputStream, private kj::BufferedInputStreamWrapper,
+                             public PackedMessageReader {
+public:
+  PackedFdMessageReader(int fd, ReaderOptions options = ReaderOptions(),
+                        kj::ArrayPtr<word> scratchSpace = nullptr)
+      : FdInputStream(fd),
+        BufferedInputStreamWrapper(static_cast<FdInputStream&>(*this)),
+        PackedMessageReader(static_cast<BufferedInputStreamWrapper&>(*this),
+                            options, scratchSpace) {}
+};
+
+inline void writePackedMessage(kj::BufferedOutputStream& output,
+                               kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  PackedOutputStream packedOutput(output);
+  writeMessage(packedOutput, segments);
+}
+
+inline void writePackedMessage(kj::OutputStream& output,
+                               kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  kj::BufferedOutputStreamWrapper buffered(output);
+  writePackedMessage(buffered, segments);
+  buffered.flush();
+}
+
+inline void writePackedMessage(kj::BufferedOutputStream& output, MessageBuilder& builder) {
+  writePackedMessage(output, builder.getSegmentsForOutput());
+}
+
+inline void writePackedMessage(kj::OutputStream& output, MessageBuilder& builder) {
+  writePackedMessage(output, builder.getSegmentsForOutput());
+}
+
+inline void writePackedMessageToFd(int fd, MessageBuilder& builder) {
+  kj::FdOutputStream output(fd);
+  writePackedMessage(output, builder);
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_PACKED_H_
@@ -0,0 +1,262 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_PARALLEL_H_
+#define CAPNP_ALTCXX_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <kj/array.h>
+#include <kj/common.h>
+
+namespace capnp {
+namespace altcxx {
+
+class WorkStealingPool {
+  // Runs batches of numbered tasks on a fixed set of threads.  Each thread starts with its own
+  // contiguous share of the task numbers and, once that runs out, steals half of what's left in
+  // another thread's share, so uneven tasks still keep every thread busy.
+  //
+  // The thread calling run() works too, so a pool of N threads starts N - 1 of its own.  Tasks
+  // must not call run() on the pool they're running on.
+
+public:
+  explicit WorkStealingPool(uint threadCount = std::max(1u, std::thread::hardware_concurrency()))
+      : queues(new Queue[std::max(1u, threadCount)]), queueCount(std::max(1u, threadCount)) {
+    for (uint i = 1; i < queueCount; i++) {
+      threads.emplace_back([this, i]() { workerLoop(i); });
+    }
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread: threads) {
+      thread.join();
+    }
+  }
+
+  KJ_DISALLOW_COPY(WorkStealingPool);
+
+  uint getThreadCount() const { return queueCount; }
+
+  template <typename Func>
+  void run(uint taskCount, Func&& func) {
+    // Calls func(task) for each task in [0, taskCount) and waits for all of them.  If any task
+    // throws, tasks not started yet are skipped and the first exception is rethrown here.
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+
+    for (uint i = 0; i < queueCount; i++) {
+      std::lock_guard<std::mutex> lock(queues[i].mutex);
+      queues[i].next = uint64_t(taskCount) * i / queueCount;
+      queues[i].end = uint64_t(taskCount) * (i + 1) / queueCount;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = const_cast<void*>(static_cast<const void*>(&func));
+      callJob = &call<typename std::remove_reference<Func>::type>;
+      error = nullptr;
+      failed = false;
+      busy = threads.size();
+      ++generation;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return busy == 0; });
+    job = nullptr;
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    uint next = 0;
+    uint end = 0;
+  };
+
+  std::unique_ptr<Queue[]> queues;
+  uint queueCount;
+  std::vector<std::thread> threads;
+
+  std::mutex runMutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  void* job = nullptr;
+  void (*callJob)(void*, uint) = nullptr;
+  std::exception_ptr error;
+  std::atomic<bool> failed{false};
+  bool stopping = false;
+  uint busy = 0;
+  uint64_t generation = 0;
+
+  template <typename Func>
+  static void call(void* func, uint task) {
+    (*static_cast<Func*>(func))(task);
+  }
+
+  bool take(uint self, uint& task) {
+    {
+      Queue& own = queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.next < own.end) {
+        task = own.next++;
+        return true;
+      }
+    }
+
+    for (uint i = 1; i < queueCount; i++) {
+      uint begin, end;
+      {
+        Queue& victim = queues[(self + i) % queueCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.next >= victim.end) continue;
+        end = victim.end;
+        begin = victim.end - (victim.end - victim.next + 1) / 2;
+        victim.end = begin;
+      }
+
+      // Our own queue is empty, so nobody steals from it in the meantime.
+      Queue& own = queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      own.next = begin + 1;
+      own.end = end;
+      task = begin;
+      return true;
+    }
+
+    return false;
+  }
+
+  void work(uint self) {
+    uint task;
+    while (take(self, task)) {
+      if (failed) continue;
+      try {
+        callJob(job, task);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed) {
+          failed = true;
+          error = std::current_exception();
+        }
+      }
+    }
+  }
+
+  void workerLoop(uint self) {
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+      }
+
+      work(self);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0) {
+        finished.notify_all();
+      }
+    }
+  }
+};
+
+inline WorkStealingPool& defaultPool() {
+  // Shared pool with one thread per core, started on first use.
+  static WorkStealingPool pool;
+  return pool;
+}
+
+template <typename ListReader, typename Func>
+void parallelFor(WorkStealingPool& pool, ListReader list, Func&& func, uint grainSize = 1024) {
+  // Calls func(index, element) for every element of `list`, in chunks of `grainSize` elements.
+  // Readers are immutable, so every task simply indexes into the same list.
+
+  uint size = list.size();
+  uint chunks = (size + grainSize - 1) / grainSize;
+  pool.run(chunks, [&](uint chunk) {
+    uint end = std::min(size, (chunk + 1) * grainSize);
+    for (uint i = chunk * grainSize; i < end; i++) {
+      func(i, list[i]);
+    }
+  });
+}
+
+template <typename ListReader, typename Result, typename Map, typename Combine>
+Result parallelReduce(WorkStealingPool& pool, ListReader list, Result identity,
+                      Map&& map, Combine&& combine, uint grainSize = 1024) {
+  // Folds combine(result, map(element)) over `list`.  Each chunk is folded on its own and the
+  // partial results are combined in list order, and chunk boundaries depend only on
+  // `grainSize`, so the result doesn't depend on the number of threads or on scheduling even
+  // when `combine` is only associative (e.g. floating point addition, string concatenation).
+
+  uint size = list.size();
+  uint chunks = (size + grainSize - 1) / grainSize;
+  // Not a std::vector, whose bool specialization packs the partials of different tasks into the
+  // same word.
+  auto builder = kj::heapArrayBuilder<Result>(chunks);
+  for (uint i = 0; i < chunks; i++) {
+    builder.add(identity);
+  }
+  kj::Array<Result> partials = builder.finish();
+  pool.run(chunks, [&](uint chunk) {
+    Result partial = identity;
+    uint end = std::min(size, (chunk + 1) * grainSize);
+    for (uint i = chunk * grainSize; i < end; i++) {
+      partial = combine(kj::mv(partial), map(list[i]));
+    }
+    partials[chunk] = kj::mv(partial);
+  });
+
+  Result result = kj::mv(identity);
+  for (auto& partial: partials) {
+    result = combine(kj::mv(result), kj::mv(partial));
+  }
+  return result;
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_PARALLEL_H_
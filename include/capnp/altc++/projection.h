@@ -0,0 +1,77 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_PROJECTION_H_
+#define CAPNP_ALTCXX_PROJECTION_H_
+
+#include <capnp/any.h>
+#include "impl.h"
+
+namespace capnp {
+namespace altcxx {
+
+// Compile-time lists of the slots a projection copies.  Values are copied as stored, so default
+// XORing and pointer targets carry over unchanged.
+
+template <uint bits> struct SlotType;
+template <> struct SlotType<1> { typedef bool Type; };
+template <> struct SlotType<8> { typedef uint8_t Type; };
+template <> struct SlotType<16> { typedef uint16_t Type; };
+template <> struct SlotType<32> { typedef uint32_t Type; };
+template <> struct SlotType<64> { typedef uint64_t Type; };
+
+template <uint offset, uint bits>
+struct DataSlot {
+  // `offset` is in multiples of `bits`, as in the schema.
+  typedef typename SlotType<bits>::Type Type;
+
+  static void copy(_::StructReader from, _::StructBuilder to) {
+    to.setDataField<Type>(offset * ELEMENTS, from.getDataField<Type>(offset * ELEMENTS));
+  }
+};
+
+template <uint offset>
+struct PointerSlot {
+  static void copy(_::StructReader from, _::StructBuilder to) {
+    auto ptr = from.getPointerField(offset);
+    if (ptr.isNull()) {
+      to.getPointerField(offset).clear();
+    } else {
+      AnyPointer::Builder(to.getPointerField(offset)).set(AnyPointer::Reader(ptr));
+    }
+  }
+};
+
+template <typename... Slots>
+struct FieldPlan {
+  static void copy(_::StructReader from, _::StructBuilder to) {
+    int dummy[] = { 0, (Slots::copy(from, to), 0)... };
+    (void)dummy;
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_PROJECTION_H_
@@ -72,25 +72,87 @@ struct NoDefault {
     return _::PointerHelpers<T>::get(ptr);
   }
 
-  static decltype(nullptr) ptr() { return nullptr; }
+  static _::StructReader getStruct(_::PointerReader ptr, _::StructSize size) {
+    return ReaderHelper::getStruct(ptr, size, nullptr);
+  }
+
+  static _::StructBuilder getStruct(_::PointerBuilder ptr, _::StructSize size) {
+    return BuilderHelper::getStruct(ptr, size, nullptr);
+  }
+};
+
+// Readers of null fields with defaults don't decode the default from the schema on every access.
+// Blob defaults are stored as plain bytes and are wrapped directly, struct and list defaults are
+// decoded once on first use.
+
+template <typename T> struct BlobDefault;
+
+template <>
+struct BlobDefault<Text> {
+  static Text::Reader get(const word* bytes, uint size) {
+    return Text::Reader(reinterpret_cast<const char*>(bytes), size);
+  }
+};
+
+template <>
+struct BlobDefault<Data> {
+  static Data::Reader get(const word* bytes, uint size) {
+    return Data::Reader(reinterpret_cast<const byte*>(bytes), size);
+  }
 };
 
 template <const _::RawSchema* raw, uint offset, uint size = 0>
 struct PointerDefault {
+  // Blobs.
+
   template <typename T, typename Impl>
-  static typename Impl::template TypeFor<T> get(typename Impl::Pointer ptr) {
+  static ReaderFor<T> get(_::PointerReader ptr) {
+    if (ptr.isNull()) return BlobDefault<T>::get(raw->encodedNode + offset, size);
+    return _::PointerHelpers<T>::get(ptr);
+  }
+
+  template <typename T, typename Impl>
+  static BuilderFor<T> get(_::PointerBuilder ptr) {
     return _::PointerHelpers<T>::get(ptr, raw->encodedNode + offset, size);
   }
 };
 
 template <const _::RawSchema* raw, uint offset>
 struct PointerDefault<raw, offset, 0> {
+  // Structs and lists.
+
   template <typename T, typename Impl>
-  static typename Impl::template TypeFor<T> get(typename Impl::Pointer ptr) {
+  static ReaderFor<T> get(_::PointerReader ptr) {
+    if (ptr.isNull()) return defaultReader<T>();
+    return _::PointerHelpers<T>::get(ptr);
+  }
+
+  template <typename T, typename Impl>
+  static BuilderFor<T> get(_::PointerBuilder ptr) {
     return _::PointerHelpers<T>::get(ptr, raw->encodedNode + offset);
   }
 
-  static const word* ptr() { return raw->encodedNode + offset; }
+  static _::StructReader getStruct(_::PointerReader ptr, _::StructSize size) {
+    if (ptr.isNull()) return defaultStruct();
+    return ReaderHelper::getStruct(ptr, size, nullptr);
+  }
+
+  static _::StructBuilder getStruct(_::PointerBuilder ptr, _::StructSize size) {
+    return BuilderHelper::getStruct(ptr, size, raw->encodedNode + offset);
+  }
+
+private:
+  template <typename T>
+  static ReaderFor<T> defaultReader() {
+    static ReaderFor<T> value = _::PointerHelpers<T>::get(_::PointerReader(),
+                                                          raw->encodedNode + offset);
+    return value;
+  }
+
+  static _::StructReader defaultStruct() {
+    static _::StructReader value = _::PointerReader().getStruct(raw->encodedNode + offset);
+    return value;
+  }
 };
 
 // =======================================================================================
@@ -142,10 +204,16 @@ struct PointerTransform {
   static typename Helper::Struct transform(T* ptr) {
     typename Helper::Struct s = Parent::transform(ptr);
     Union::check(s);
-    return Helper::getStruct(s.getPointerField(Off::VALUE), Size::value, Default::ptr());
+    return Default::getStruct(s.getPointerField(Off::VALUE), Size::value);
   }
 };
 
+// Impl for properties of a struct stored behind a pointer field, but exposed on the parent.
+
+template <typename Impl, uint offset, typename T>
+using ColdImpl = typename Impl::template Push<Apply<PointerTransform, Constant<uint, offset>,
+    _::StructSize_<T>, NoDefault, NotInUnion>::template Result>;
+
 // =======================================================================================
 // Property types.
 
@@ -341,6 +409,18 @@ struct ListProperty: ContainerProperty<Impl, offset, List<T>, Default, Union> {
   template <typename U, typename = kj::EnableIf<!Impl::CONST>>
   void set(uint index, U&& value) { this->get().set(index, kj::fwd<U>(value)); }
 
+  template <typename Range, typename Projector, typename = kj::EnableIf<!Impl::CONST>>
+  typename List<T>::Builder fill(const Range& range, Projector&& projector) {
+    // Initializes the list to the size of `range` and calls projector(element, item) for each
+    // item in order.  The list is resolved once, unlike when going through operator[].
+    auto list = init(range.size());
+    uint i = 0;
+    for (auto& item: range) {
+      projector(list[i++], item);
+    }
+    return list;
+  }
+
   template <typename = kj::EnableIf<!Impl::CONST && kind<T>() == Kind::STRUCT>>
   void adoptWithCaveats(uint i, Orphan<T>&& o) { this->get().adoptWithCaveats(i, kj::mv(o)); }
 
@@ -376,6 +456,16 @@ struct ListProperty: ContainerProperty<Impl, offset, List<T>, Default, Union> {
   ListProperty& operator = (kj::ArrayPtr<const ReaderFor<T>> val) { set(val); return *this; }
 };
 
+template <typename T>
+size_t listSizeHint(size_t count, size_t blobBytes = 0, size_t blobCount = 0) {
+  // Upper bound, in words, of a List(T) of `count` structs together with `blobCount` blobs of
+  // `blobBytes` in total hanging off its elements.  Use it to size the first segment of a
+  // message before ListProperty::fill(), so elements and blobs are laid out contiguously in one
+  // segment, in the order they're written.
+  return 1 + count * (_::StructSize_<T>::value.total() / WORDS) +
+      (blobBytes + blobCount * sizeof(word)) / sizeof(word);
+}
+
 // ---------------------------------------------------------------------------------------
 
 template <typename Impl, uint offset, typename Union = NotInUnion>
@@ -0,0 +1,297 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_RESULT_CACHE_H_
+#define CAPNP_ALTCXX_RESULT_CACHE_H_
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <capnp/any.h>
+#include <capnp/capability.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <kj/refcount.h>
+#include "impl.h"
+
+namespace capnp {
+namespace altcxx {
+
+class ResultCache {
+  // Keeps results of methods annotated with $cacheable, so repeated calls with the same params
+  // on the same capability are answered without a round trip.  Generated clients have
+  // `<method>Cached(request)` next to `<method>Request()`, which goes through the cache of the
+  // calling thread, and `invalidateCachedResults()`.
+  //
+  // Entries are keyed by the capability, the method and a flat copy of the params, and are
+  // evicted least recently used first once the cache is full, or once their time to live is over.
+  // Results are kept as flat copies too, so neither params nor results of cached methods may
+  // contain capabilities.
+  //
+  // The cache holds one reference to each capability it has entries for.  Whenever a result is
+  // added, capabilities no one else refers to any more are let go, along with their entries, so
+  // results that don't expire don't keep dead capabilities alive.  (Capabilities whose hooks
+  // aren't refcounted are kept until their entries are evicted.)  A response that arrives after
+  // its capability's entries were invalidated is passed on but not cached.
+
+public:
+  explicit ResultCache(size_t capacity = 1024): capacity(capacity) {}
+  KJ_DISALLOW_COPY(ResultCache);
+
+  static ResultCache& forThread() {
+    static thread_local ResultCache cache;
+    return cache;
+  }
+
+  template <typename Params, typename Results>
+  kj::Promise<Response<Results>> call(ClientHook& target, uint64_t interfaceId, uint16_t methodId,
+                                      Request<Params, Results>&& request, uint ttlMillis) {
+    // Returns a cached response if there's one, otherwise sends the request and caches the
+    // response.  A zero ttlMillis means results don't expire.
+    auto key = makeKey<Params>(target, interfaceId, methodId,
+        BuilderImpl::asReader(BuilderImpl::asStruct(
+            static_cast<typename Params::Builder*>(&request))));
+
+    KJ_IF_MAYBE(entry, find(key)) {
+      ++hits;
+      return makeResponse<Results>(**entry);
+    }
+
+    ++misses;
+    auto expiry = ttlMillis == 0 ? Clock::time_point::max() :
+                  Clock::now() + std::chrono::milliseconds(ttlMillis);
+    auto pending = kj::heap<PendingCall>(*this, track(target));
+    return request.send().then(kj::mvCapture(key, kj::mvCapture(pending,
+        [this, expiry](kj::Own<PendingCall>&& pending, std::string&& key,
+                       Response<Results>&& response) {
+      if (pending->target.generation == pending->generation) {
+        MallocMessageBuilder copy;
+        copy.getRoot<AnyPointer>().setAs<Results>(response);
+        insert(kj::mv(key), kj::refcounted<Entry>(pending->targetId, messageToFlatArray(copy),
+                                                  expiry));
+      }
+      pending = nullptr;
+      sweep();
+      return kj::mv(response);
+    })));
+  }
+
+  void invalidate() {
+    for (auto& target: targets) {
+      ++target.second.generation;
+    }
+    while (!entries.empty()) {
+      erase(entries.begin());
+    }
+  }
+
+  void invalidate(ClientHook& target) {
+    // Drops the results of every method of one capability.  Calls already on their way won't
+    // add theirs.
+    auto i = targets.find(&target);
+    if (i == targets.end()) return;
+    ++i->second.generation;
+    eraseEntries(&target);
+  }
+
+  void setCapacity(size_t newCapacity) {
+    capacity = newCapacity;
+    trim();
+  }
+
+  size_t size() const { return entries.size(); }
+  uint64_t getHits() const { return hits; }
+  uint64_t getMisses() const { return misses; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Target {
+    kj::Own<ClientHook> hook;
+    uint64_t generation = 0;  // Bumped when the target's entries are invalidated.
+    size_t entryCount = 0;
+    size_t pendingCount = 0;
+
+    explicit Target(kj::Own<ClientHook>&& hook): hook(kj::mv(hook)) {}
+  };
+
+  struct Entry: public kj::Refcounted {
+    const ClientHook* target;
+    kj::Array<word> words;
+    Clock::time_point expiry;
+
+    Entry(const ClientHook* target, kj::Array<word>&& words, Clock::time_point expiry)
+        : target(target), words(kj::mv(words)), expiry(expiry) {}
+  };
+
+  struct PendingCall {
+    // Keeps the target's bookkeeping around while a call on it is in flight.
+
+    ResultCache& cache;
+    const ClientHook* targetId;
+    Target& target;
+    uint64_t generation;
+
+    PendingCall(ResultCache& cache, Target& target)
+        : cache(cache), targetId(target.hook.get()), target(target),
+          generation(target.generation) {
+      ++target.pendingCount;
+    }
+    ~PendingCall() {
+      --target.pendingCount;
+      cache.release(targetId);
+    }
+    KJ_DISALLOW_COPY(PendingCall);
+  };
+
+  class CachedResponse final: public ResponseHook {
+  public:
+    explicit CachedResponse(kj::Own<Entry>&& entry)
+        : entry(kj::mv(entry)), reader(this->entry->words) {}
+
+    FlatArrayMessageReader& getReader() { return reader; }
+
+  private:
+    kj::Own<Entry> entry;
+    FlatArrayMessageReader reader;
+  };
+
+  typedef std::list<std::pair<std::string, kj::Own<Entry>>> Entries;
+
+  size_t capacity;
+  Entries entries;  // Most recently used first.
+  std::unordered_map<std::string, Entries::iterator> index;
+  std::unordered_map<const ClientHook*, Target> targets;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  template <typename Params>
+  static std::string makeKey(ClientHook& target, uint64_t interfaceId, uint16_t methodId,
+                             _::StructReader params) {
+    // Copying lays the params out in a fixed order, so equal params make equal keys no matter
+    // how the request was built.
+    MallocMessageBuilder copy;
+    copy.getRoot<AnyPointer>().setAs<Params>(typename Params::Reader(params));
+    auto words = messageToFlatArray(copy);
+    auto bytes = words.asBytes();
+
+    const void* targetId = &target;
+    std::string key;
+    key.reserve(sizeof(targetId) + sizeof(interfaceId) + sizeof(methodId) + bytes.size());
+    key.append(reinterpret_cast<const char*>(&targetId), sizeof(targetId));
+    key.append(reinterpret_cast<const char*>(&interfaceId), sizeof(interfaceId));
+    key.append(reinterpret_cast<const char*>(&methodId), sizeof(methodId));
+    key.append(reinterpret_cast<const char*>(bytes.begin()), bytes.size());
+    return key;
+  }
+
+  kj::Maybe<Entry&> find(const std::string& key) {
+    auto i = index.find(key);
+    if (i == index.end()) return nullptr;
+    if (Clock::now() >= i->second->second->expiry) {
+      erase(i->second);
+      return nullptr;
+    }
+    entries.splice(entries.begin(), entries, i->second);
+    return *entries.front().second;
+  }
+
+  Target& track(ClientHook& hook) {
+    auto i = targets.find(&hook);
+    if (i == targets.end()) {
+      i = targets.emplace(&hook, Target(hook.addRef())).first;
+    }
+    return i->second;
+  }
+
+  void release(const ClientHook* targetId) {
+    // Forgets a target once it has neither entries nor calls in flight.
+    auto i = targets.find(targetId);
+    if (i != targets.end() && i->second.entryCount == 0 && i->second.pendingCount == 0) {
+      targets.erase(i);
+    }
+  }
+
+  void insert(std::string&& key, kj::Own<Entry>&& entry) {
+    auto i = index.find(key);
+    if (i != index.end()) {
+      erase(i->second);
+    }
+    ++targets.at(entry->target).entryCount;
+    entries.emplace_front(kj::mv(key), kj::mv(entry));
+    index.emplace(entries.front().first, entries.begin());
+    trim();
+  }
+
+  void erase(Entries::iterator entry) {
+    const ClientHook* targetId = entry->second->target;
+    index.erase(entry->first);
+    entries.erase(entry);
+    --targets.at(targetId).entryCount;
+    release(targetId);
+  }
+
+  void eraseEntries(const ClientHook* targetId) {
+    for (auto i = entries.begin(); i != entries.end();) {
+      auto next = i;
+      ++next;
+      if (i->second->target == targetId) erase(i);
+      i = next;
+    }
+  }
+
+  void trim() {
+    while (entries.size() > capacity) {
+      erase(--entries.end());
+    }
+  }
+
+  void sweep() {
+    // Lets go of capabilities the cache holds the only reference to.
+    std::vector<const ClientHook*> unused;
+    for (auto& target: targets) {
+      auto counted = dynamic_cast<kj::Refcounted*>(target.second.hook.get());
+      if (counted != nullptr && !counted->isShared() && target.second.pendingCount == 0) {
+        unused.push_back(target.first);
+      }
+    }
+    for (auto targetId: unused) {
+      eraseEntries(targetId);
+    }
+  }
+
+  template <typename Results>
+  static kj::Promise<Response<Results>> makeResponse(Entry& entry) {
+    auto hook = kj::heap<CachedResponse>(kj::addRef(entry));
+    auto root = hook->getReader().template getRoot<Results>();
+    return Response<Results>(root, kj::mv(hook));
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_RESULT_CACHE_H_
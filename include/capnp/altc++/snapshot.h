@@ -0,0 +1,145 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_SNAPSHOT_H_
+#define CAPNP_ALTCXX_SNAPSHOT_H_
+
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <kj/debug.h>
+#include <capnp/any.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+namespace capnp {
+namespace altcxx {
+
+template <typename T>
+class SnapshotCache {
+  // Holds the current version of a read-mostly message, e.g. configuration, which any number of
+  // threads can read while a writer publishes new versions.
+  //
+  // Published messages are validated once, while being copied into a flat buffer, and are read
+  // without bounds checks or traversal limit accounting afterwards.  Snapshots are immutable and
+  // reference counted, so readers keep the version they got alive for as long as they use it.
+
+public:
+  class Snapshot {
+  public:
+    Snapshot(kj::Array<word>&& words, uint64_t version)
+        : words(kj::mv(words)), version(version) {}
+
+    typename T::Reader getRoot() const { return readMessageUnchecked<T>(words.begin()); }
+    uint64_t getVersion() const { return version; }
+
+  private:
+    kj::Array<word> words;
+    uint64_t version;
+  };
+
+  class LocalReader {
+    // One per thread.  Checking for a new version is a single relaxed load of a counter which
+    // only changes on publish, so readers on different cores don't contend.
+    //
+    // The LocalReader holds only the snapshot it last returned: a Reader from get() is valid
+    // until the next get(), which may release the snapshot it points into.  Keep the result of
+    // getSnapshot() to read a version for longer.
+
+  public:
+    explicit LocalReader(const SnapshotCache& cache): cache(cache) {}
+    KJ_DISALLOW_COPY(LocalReader);
+
+    typename T::Reader get() {
+      refresh();
+      return snapshot->getRoot();
+    }
+
+    std::shared_ptr<const Snapshot> getSnapshot() {
+      // Copying the shared_ptr touches the count all threads share, so only do it to pin.
+      refresh();
+      return snapshot;
+    }
+
+  private:
+    const SnapshotCache& cache;
+    std::shared_ptr<const Snapshot> snapshot;
+
+    void refresh() {
+      if (snapshot == nullptr ||
+          snapshot->getVersion() != cache.version.load(std::memory_order_relaxed)) {
+        snapshot = cache.get();
+      }
+    }
+  };
+
+  SnapshotCache() = default;
+  KJ_DISALLOW_COPY(SnapshotCache);
+
+  uint64_t publish(AnyPointer::Reader root) {
+    // Copies the message rooted at `root`, checking it within the limits of the reader it comes
+    // from.  Returns the version of the new snapshot.
+
+    size_t size = root.targetSize().wordCount + 1;
+    auto words = kj::heapArray<word>(size);
+    memset(words.begin(), 0, size * sizeof(word));
+    copyToUnchecked(root, words);
+
+    std::lock_guard<std::mutex> lock(publishMutex);
+    uint64_t newVersion = version.load(std::memory_order_relaxed) + 1;
+    std::atomic_store(&current,
+        std::shared_ptr<const Snapshot>(std::make_shared<Snapshot>(kj::mv(words), newVersion)));
+    version.store(newVersion, std::memory_order_release);
+    return newVersion;
+  }
+
+  uint64_t publish(MessageReader& message) {
+    return publish(message.getRoot<AnyPointer>());
+  }
+
+  uint64_t publish(kj::ArrayPtr<const word> flatMessage, ReaderOptions options = ReaderOptions()) {
+    FlatArrayMessageReader message(flatMessage, options);
+    return publish(message);
+  }
+
+  std::shared_ptr<const Snapshot> get() const {
+    auto result = std::atomic_load(&current);
+    KJ_REQUIRE(result != nullptr, "Nothing was published yet.");
+    return result;
+  }
+
+  uint64_t getVersion() const { return version.load(std::memory_order_acquire); }
+  // 0 until the first publish.
+
+private:
+  std::shared_ptr<const Snapshot> current;
+  std::atomic<uint64_t> version{0};
+  std::mutex publishMutex;
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_SNAPSHOT_H_
@@ -0,0 +1,316 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_STREAM_H_
+#define CAPNP_ALTCXX_STREAM_H_
+
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <kj/debug.h>
+#include <capnp/endian.h>
+#include <capnp/message.h>
+
+namespace capnp {
+namespace altcxx {
+
+template <typename T>
+class MessageStream {
+  // Reads consecutive messages in the standard stream format, e.g. a log written with
+  // MessageBatch.  A background thread reads ahead into large buffers, handing off the messages
+  // each read completes as a chunk, and messages are read in place: a Message only holds a
+  // reference to its chunk, whose buffer goes back to a pool for the next read once every
+  // Message in it is gone.
+  //
+  // A message bigger than a chunk gets a chunk of its own.  Destroying the stream waits for the
+  // read in progress, which for a pipe or socket means until more data or EOF comes in.
+
+  struct Chunk;
+
+public:
+  struct Options {
+    size_t chunkWords;
+    uint readahead;
+    // Chunks filled ahead of the one being read.
+    ReaderOptions readerOptions;
+
+    Options(): chunkWords(128 * 1024), readahead(4) {}
+  };
+
+  class Message {
+  public:
+    Message(std::shared_ptr<const Chunk> chunk, kj::Array<kj::ArrayPtr<const word>>&& segments,
+            ReaderOptions options)
+        : chunk(kj::mv(chunk)), segments(kj::mv(segments)), reader(this->segments, options) {}
+    KJ_DISALLOW_COPY(Message);
+
+    typename T::Reader getRoot() { return reader.template getRoot<T>(); }
+    MessageReader& getReader() { return reader; }
+
+  private:
+    std::shared_ptr<const Chunk> chunk;
+    kj::Array<kj::ArrayPtr<const word>> segments;
+    SegmentArrayMessageReader reader;
+  };
+
+  explicit MessageStream(int fd, Options options = Options())
+      : fd(fd), options(options),
+        pool(std::make_shared<Pool>(options.chunkWords, options.readahead + 2)) {
+    KJ_REQUIRE(options.chunkWords > 0 && options.readahead > 0);
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Only a hint; fails harmlessly on pipes and sockets.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    thread = std::thread([this]() { readAhead(); });
+  }
+
+  ~MessageStream() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+  }
+
+  KJ_DISALLOW_COPY(MessageStream);
+
+  kj::Own<Message> next() {
+    // Returns null at the end of the stream, and throws if it ends within a message or holds
+    // an invalid segment table, once the messages before that have been returned.
+
+    while (current == nullptr || position == current->size) {
+      current = nullptr;
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this]() { return !ready.empty() || done; });
+      if (ready.empty()) {
+        KJ_IF_MAYBE(exception, error) {
+          auto copy = kj::mv(*exception);
+          error = nullptr;
+          kj::throwFatalException(kj::mv(copy));
+        }
+        return nullptr;
+      }
+      current = kj::mv(ready.front());
+      ready.pop_front();
+      position = 0;
+      changed.notify_all();
+    }
+
+    // The reader thread checked the table already.
+    auto table = reinterpret_cast<const _::WireValue<uint32_t>*>(
+        current->buffer.begin() + position);
+    uint segmentCount = table[0].get() + 1;
+    size_t offset = position + segmentCount / 2 + 1;
+    auto segments = kj::heapArrayBuilder<kj::ArrayPtr<const word>>(segmentCount);
+    for (uint i = 0; i < segmentCount; i++) {
+      size_t size = table[i + 1].get();
+      segments.add(current->buffer.begin() + offset, size);
+      offset += size;
+    }
+    position = offset;
+
+    return kj::heap<Message>(current, segments.finish(), options.readerOptions);
+  }
+
+private:
+  class Pool {
+    // Chunk buffers of the usual size, kept for reuse.
+
+  public:
+    Pool(size_t chunkWords, size_t capacity): chunkWords(chunkWords), capacity(capacity) {}
+
+    kj::Array<word> take(size_t minWords) {
+      if (minWords <= chunkWords) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buffers.empty()) {
+          auto result = kj::mv(buffers.back());
+          buffers.pop_back();
+          return kj::mv(result);
+        }
+      }
+      return kj::heapArray<word>(kj::max(minWords, chunkWords));
+    }
+
+    void release(kj::Array<word>&& buffer) {
+      if (buffer.size() != chunkWords) return;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (buffers.size() < capacity) {
+        buffers.push_back(kj::mv(buffer));
+      }
+    }
+
+  private:
+    size_t chunkWords;
+    size_t capacity;
+    std::mutex mutex;
+    std::vector<kj::Array<word>> buffers;
+  };
+
+  struct Chunk {
+    // `size` words of complete messages at the start of `buffer`.
+
+    Chunk(std::shared_ptr<Pool> pool, kj::Array<word>&& buffer, size_t size)
+        : pool(kj::mv(pool)), buffer(kj::mv(buffer)), size(size) {}
+    ~Chunk() { pool->release(kj::mv(buffer)); }
+    KJ_DISALLOW_COPY(Chunk);
+
+    std::shared_ptr<Pool> pool;
+    kj::Array<word> buffer;
+    size_t size;
+  };
+
+  int fd;
+  Options options;
+  std::shared_ptr<Pool> pool;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::shared_ptr<const Chunk>> ready;
+  kj::Maybe<kj::Exception> error;
+  bool done = false;
+  bool stopping = false;
+  std::thread thread;
+
+  // Only used by next().
+  std::shared_ptr<const Chunk> current;
+  size_t position = 0;
+
+  size_t frameWords(kj::ArrayPtr<const word> data) {
+    // Words taken up by the message at the start of `data` or, if its segment table isn't all
+    // there, the words needed to read the table.
+
+    if (data.size() == 0) return 1;
+    auto table = reinterpret_cast<const _::WireValue<uint32_t>*>(data.begin());
+    uint32_t lastSegment = table[0].get();
+    KJ_REQUIRE(lastSegment < 512, "Message has too many segments.");
+    size_t tableWords = (lastSegment + 1) / 2 + 1;
+    if (data.size() < tableWords) return tableWords;
+
+    size_t segmentWords = 0;
+    for (uint i = 0; i <= lastSegment; i++) {
+      segmentWords += table[i + 1].get();
+    }
+    KJ_REQUIRE(segmentWords <= options.readerOptions.traversalLimitInWords,
+               "Message is too large.  To increase the limit on the receiving end, see "
+               "capnp::ReaderOptions.");
+    return tableWords + segmentWords;
+  }
+
+  void readAhead() {
+    auto maybeException = kj::runCatchingExceptions([this]() { readChunks(); });
+    KJ_IF_MAYBE(exception, maybeException) {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = kj::mv(*exception);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    changed.notify_all();
+  }
+
+  void readChunks() {
+    auto buffer = pool->take(0);
+    size_t filled = 0;    // bytes
+    size_t complete = 0;  // words of complete messages at the start of `buffer`
+    size_t needed = 1;    // words the message after them takes up, as far as is known yet
+
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return;
+      }
+
+      // A single read at a time: on a pipe or socket, a short read may be all there is for a
+      // while, and the messages it completes shouldn't wait for the buffer to fill.
+      byte* bytes = reinterpret_cast<byte*>(buffer.begin());
+      ssize_t n;
+      KJ_SYSCALL(n = ::read(fd, bytes + filled, buffer.size() * sizeof(word) - filled));
+      filled += n;
+
+      auto maybeException = kj::runCatchingExceptions([&]() {
+        for (;;) {
+          auto rest = kj::arrayPtr(buffer.begin() + complete, filled / sizeof(word) - complete);
+          needed = frameWords(rest);
+          if (needed > rest.size()) break;
+          complete += needed;
+        }
+      });
+      KJ_IF_MAYBE(exception, maybeException) {
+        // The messages before the bad segment table still get read.
+        if (complete > 0 && !pushChunk(kj::mv(buffer), complete)) return;
+        kj::throwFatalException(kj::mv(*exception));
+      }
+
+      if (n == 0) {
+        size_t leftover = filled - complete * sizeof(word);
+        if (complete > 0 && !pushChunk(kj::mv(buffer), complete)) return;
+        KJ_REQUIRE(leftover == 0, "Premature EOF.");
+        return;
+      }
+
+      // Whatever follows the last complete message starts the next buffer, which must be big
+      // enough to hold all of that message.
+      if (complete > 0 || needed > buffer.size()) {
+        size_t start = complete * sizeof(word);
+        auto next = pool->take(needed);
+        memcpy(next.begin(), bytes + start, filled - start);
+        if (complete > 0) {
+          if (!pushChunk(kj::mv(buffer), complete)) return;
+        } else {
+          pool->release(kj::mv(buffer));
+        }
+        buffer = kj::mv(next);
+        filled -= start;
+        complete = 0;
+      }
+    }
+  }
+
+  bool pushChunk(kj::Array<word>&& buffer, size_t words) {
+    // Queues the first `words` words of `buffer` for next(), once there's room.  Returns false
+    // if the stream is being destroyed.
+
+    auto chunk = std::make_shared<const Chunk>(pool, kj::mv(buffer), words);
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return ready.size() < options.readahead || stopping; });
+    if (stopping) return false;
+    ready.push_back(kj::mv(chunk));
+    lock.unlock();
+    changed.notify_all();
+    return true;
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_STREAM_H_
@@ -0,0 +1,129 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_TEXT_POOL_H_
+#define CAPNP_ALTCXX_TEXT_POOL_H_
+
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <capnp/message.h>
+#include "property.h"
+
+namespace capnp {
+namespace altcxx {
+
+class TextPool {
+  // Sets Text and Data fields of a message under construction, storing each distinct short
+  // value once and pointing every field holding it at the same copy.  Readers don't care how
+  // many pointers lead to an object, so the result is an ordinary valid message, smaller and
+  // with better locality when values repeat a lot (enum-like names, tags, country codes...).
+  //
+  // Objects are shared only within a segment, since pointing across segments would need a far
+  // pointer landing pad; a value seen again in another segment is stored once more.  Give the
+  // message a large enough first segment to get the most out of the pool.
+  //
+  // Caveat: overwriting, clearing or disowning a pooled field through the usual setters zeroes
+  // the shared copy for every other field pointing at it.  Fields set through a pool must only
+  // be set through the pool afterwards, or not at all.  Setting a field through the pool again
+  // leaves its old value in the message, unreferenced by that field, rather than zeroing it.
+
+public:
+  explicit TextPool(MessageBuilder& message, size_t maxPooledSize = 64)
+      : message(message), maxPooledSize(maxPooledSize) {}
+  KJ_DISALLOW_COPY(TextPool);
+
+  template <typename Impl, uint offset, typename T, typename Default, typename Union>
+  void set(BlobProperty<Impl, offset, T, Default, Union>& property, ReaderFor<T> value) {
+    static_assert(!Impl::CONST, "Can't set fields of a reader.");
+
+    auto s = Impl::asStruct(&property);
+    Union::setDiscriminant(s);
+    auto pointer = s.getPointerField(offset);
+
+    // Structs are laid out as the data section followed by the pointer section.  The old value
+    // may be shared with other fields, so its pointer is dropped without zeroing its target, as
+    // the setters below would.
+    word* location = reinterpret_cast<word*>(s.getDataSectionAsBlob().end()) + offset;
+    memset(location, 0, sizeof(word));
+
+    if (value.size() > maxPooledSize) {
+      _::PointerHelpers<T>::set(pointer, value);
+      return;
+    }
+
+    auto& pool = std::is_same<T, Text>::value ? texts : datas;
+    std::string key(reinterpret_cast<const char*>(value.begin()), value.size());
+    size_t byteCount = value.size() + (std::is_same<T, Text>::value ? 1 : 0);  // NUL terminator
+    auto iter = pool.find(key);
+    if (iter != pool.end()) {
+      if (pointTo(location, iter->second, byteCount)) {
+        savedWords += (byteCount + sizeof(word) - 1) / sizeof(word);
+        return;
+      }
+    }
+
+    auto blob = _::PointerHelpers<T>::init(pointer, value.size());
+    memcpy(blob.begin(), value.begin(), value.size());
+    pool[kj::mv(key)] = reinterpret_cast<const word*>(blob.begin());
+  }
+
+  size_t getSavedWords() const { return savedWords; }
+  // Words not allocated thanks to sharing, not counting the pointers themselves.
+
+private:
+  MessageBuilder& message;
+  size_t maxPooledSize;
+  std::unordered_map<std::string, const word*> texts;
+  std::unordered_map<std::string, const word*> datas;
+  size_t savedWords = 0;
+
+  bool pointTo(word* location, const word* target, size_t byteCount) {
+    // Writes a byte list pointer at `location` to `target`, if they share a segment.
+
+    bool sameSegment = false;
+    for (auto segment: message.getSegmentsForOutput()) {
+      if (location >= segment.begin() && location < segment.end()) {
+        sameSegment = target >= segment.begin() && target < segment.end();
+        break;
+      }
+    }
+    if (!sameSegment) return false;
+
+    // List pointer: offset in words from the end of the pointer and kind 1 in the lower half,
+    // element size 2 (bytes) and element count in the upper half.
+    int32_t wordOffset = static_cast<int32_t>(target - (location + 1));
+    _::WireValue<uint32_t> halves[2];
+    halves[0].set((static_cast<uint32_t>(wordOffset) << 2) | 1);
+    halves[1].set(2 | (static_cast<uint32_t>(byteCount) << 3));
+    memcpy(location, halves, sizeof(word));
+    return true;
+  }
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_TEXT_POOL_H_
@@ -0,0 +1,354 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_TEXT_H_
+#define CAPNP_ALTCXX_TEXT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <kj/string.h>
+#include <kj/vector.h>
+#include "impl.h"
+
+namespace capnp {
+namespace altcxx {
+
+class TextWriter {
+  // Writes messages as text, in the format of capnp's stringification, or as JSON.  Field names
+  // and layout come from each struct's generated _write(), and enumerant names from the generated
+  // _enumName() of each enum, so nothing is looked up in schemas at run time.
+  //
+  // Output goes to one buffer which keeps its capacity across clear(), so a writer reused for
+  // many messages stops allocating once it has grown to the largest of them.
+  //
+  // In JSON, 64-bit integers are written as strings, Data as an array of byte values, and Void,
+  // capabilities and AnyPointer fields as null.  Null pointer fields are left out in both formats.
+
+public:
+  enum class Format { TEXT, JSON };
+
+  explicit TextWriter(Format format = Format::TEXT, size_t capacity = 1024)
+      : format(format), buffer(capacity) {}
+
+  KJ_DISALLOW_COPY(TextWriter);
+
+  template <typename T>
+  TextWriter& write(Reader<T> reader) {
+    return writeStruct<T>(ReaderImpl::asStruct(&reader));
+  }
+
+  template <typename T>
+  TextWriter& writeStruct(const _::StructReader& reader) {
+    bool outerFirst = first;
+    put(format == Format::JSON ? '{' : '(');
+    first = true;
+    T::_write(*this, reader);
+    put(format == Format::JSON ? '}' : ')');
+    first = outerFirst;
+    return *this;
+  }
+
+  kj::ArrayPtr<const char> getText() const { return buffer.asPtr(); }
+
+  kj::String finish() {
+    // Returns the text written so far and clears the buffer.
+    auto result = kj::heapString(buffer.begin(), buffer.size());
+    clear();
+    return result;
+  }
+
+  void clear() {
+    buffer.resize(0);
+    first = true;
+  }
+
+  // Called by generated _write().
+
+  template <typename T>
+  void data(kj::StringPtr name, const _::StructReader& reader, uint offset, _::Mask<T> mask) {
+    fieldName(name);
+    Write<T>::value(*this, reader.getDataField<T>(offset * ELEMENTS, mask));
+  }
+
+  void voidField(kj::StringPtr name) {
+    fieldName(name);
+    primitive(VOID);
+  }
+
+  template <typename T>
+  void pointer(kj::StringPtr name, const _::StructReader& reader, uint offset) {
+    auto ptr = reader.getPointerField(offset * POINTERS);
+    if (ptr.isNull()) return;
+    fieldName(name);
+    Write<T>::pointer(*this, ptr);
+  }
+
+  template <typename G>
+  void group(kj::StringPtr name, const _::StructReader& reader) {
+    fieldName(name);
+    writeStruct<G>(reader);
+  }
+
+private:
+  Format format;
+  kj::Vector<char> buffer;
+  bool first = true;
+
+  template <typename T, Kind k = kind<T>()>
+  struct Write;
+
+  void put(char c) { buffer.add(c); }
+  void put(kj::StringPtr text) { buffer.addAll(text.begin(), text.end()); }
+
+  void separate() {
+    if (!first) put(format == Format::JSON ? "," : ", ");
+    first = false;
+  }
+
+  void fieldName(kj::StringPtr name) {
+    separate();
+    if (format == Format::JSON) {
+      put('"');
+      put(name);
+      put("\":");
+    } else {
+      put(name);
+      put(" = ");
+    }
+  }
+
+  void putUnsigned(uint64_t value) {
+    char digits[20];
+    char* pos = digits + sizeof(digits);
+    do {
+      *--pos = '0' + value % 10;
+      value /= 10;
+    } while (value != 0);
+    buffer.addAll(pos, digits + sizeof(digits));
+  }
+
+  void putSigned(int64_t value) {
+    if (value < 0) {
+      put('-');
+      putUnsigned(-static_cast<uint64_t>(value));
+    } else {
+      putUnsigned(value);
+    }
+  }
+
+  template <typename T>
+  void putFloat(T value, int shortDigits, int fullDigits) {
+    if (std::isnan(value)) {
+      put(format == Format::JSON ? "\"NaN\"" : "nan");
+    } else if (std::isinf(value)) {
+      if (format == Format::JSON) {
+        put(value < 0 ? "\"-Infinity\"" : "\"Infinity\"");
+      } else {
+        put(value < 0 ? "-inf" : "inf");
+      }
+    } else {
+      // The shortest of the two precisions which reads back as the same value.
+      char text[32];
+      int size = snprintf(text, sizeof(text), "%.*g", shortDigits, double(value));
+      if (static_cast<T>(strtod(text, nullptr)) != value) {
+        size = snprintf(text, sizeof(text), "%.*g", fullDigits, double(value));
+      }
+      buffer.addAll(text, text + size);
+    }
+  }
+
+  void primitive(Void) { put(format == Format::JSON ? "null" : "void"); }
+  void primitive(bool value) { put(value ? "true" : "false"); }
+  void primitive(int8_t value) { putSigned(value); }
+  void primitive(int16_t value) { putSigned(value); }
+  void primitive(int32_t value) { putSigned(value); }
+  void primitive(uint8_t value) { putUnsigned(value); }
+  void primitive(uint16_t value) { putUnsigned(value); }
+  void primitive(uint32_t value) { putUnsigned(value); }
+  void primitive(float value) { putFloat(value, 6, 9); }
+  void primitive(double value) { putFloat(value, 15, 17); }
+
+  void primitive(int64_t value) {
+    // JSON readers commonly parse numbers as doubles, which lose precision past 2^53.
+    if (format == Format::JSON) put('"');
+    putSigned(value);
+    if (format == Format::JSON) put('"');
+  }
+
+  void primitive(uint64_t value) {
+    if (format == Format::JSON) put('"');
+    putUnsigned(value);
+    if (format == Format::JSON) put('"');
+  }
+
+  void enumerant(kj::StringPtr name, uint16_t value) {
+    if (name == nullptr) {
+      // Unknown to this version of the schema.
+      putUnsigned(value);
+    } else if (format == Format::JSON) {
+      put('"');
+      put(name);
+      put('"');
+    } else {
+      put(name);
+    }
+  }
+
+  void quote(kj::ArrayPtr<const char> text, bool escapeHigh) {
+    static const char HEX[] = "0123456789abcdef";
+    put('"');
+    const char* plain = text.begin();
+    for (const char* pos = text.begin(); pos != text.end(); ++pos) {
+      unsigned char c = *pos;
+      const char* escape = nullptr;
+      switch (c) {
+        case '"': escape = "\\\""; break;
+        case '\\': escape = "\\\\"; break;
+        case '\n': escape = "\\n"; break;
+        case '\r': escape = "\\r"; break;
+        case '\t': escape = "\\t"; break;
+        default:
+          if (c >= 0x20 && c != 0x7f && (c < 0x80 || !escapeHigh)) continue;
+          break;
+      }
+      buffer.addAll(plain, pos);
+      plain = pos + 1;
+      if (escape != nullptr) {
+        put(escape);
+      } else {
+        put(format == Format::JSON ? "\\u00" : "\\x");
+        put(HEX[c >> 4]);
+        put(HEX[c & 15]);
+      }
+    }
+    buffer.addAll(plain, text.end());
+    put('"');
+  }
+
+  void blob(Text::Reader text) {
+    quote(text, false);
+  }
+
+  void blob(Data::Reader data) {
+    if (format == Format::JSON) {
+      put('[');
+      for (size_t i = 0; i < data.size(); i++) {
+        if (i > 0) put(',');
+        putUnsigned(data[i]);
+      }
+      put(']');
+    } else {
+      quote(kj::arrayPtr(reinterpret_cast<const char*>(data.begin()), data.size()), true);
+    }
+  }
+
+  template <typename T>
+  void list(typename List<T>::Reader list) {
+    bool outerFirst = first;
+    put('[');
+    first = true;
+    for (uint i = 0; i < list.size(); i++) {
+      separate();
+      Write<T>::value(*this, list[i]);
+    }
+    put(']');
+    first = outerFirst;
+  }
+
+  void placeholder(kj::StringPtr text) {
+    put(format == Format::JSON ? kj::StringPtr("null") : text);
+  }
+};
+
+template <typename T>
+struct TextWriter::Write<T, Kind::PRIMITIVE> {
+  static void value(TextWriter& writer, T value) { writer.primitive(value); }
+};
+
+template <typename T>
+struct TextWriter::Write<T, Kind::ENUM> {
+  static void value(TextWriter& writer, T value) {
+    writer.enumerant(_enumName(value), static_cast<uint16_t>(value));
+  }
+};
+
+template <typename T>
+struct TextWriter::Write<T, Kind::BLOB> {
+  static void value(TextWriter& writer, ReaderFor<T> value) { writer.blob(value); }
+  static void pointer(TextWriter& writer, _::PointerReader ptr) {
+    writer.blob(_::PointerHelpers<T>::get(ptr));
+  }
+};
+
+template <typename T>
+struct TextWriter::Write<T, Kind::STRUCT> {
+  static void value(TextWriter& writer, typename T::Reader value) {
+    writer.writeStruct<T>(ReaderImpl::asStruct(&value));
+  }
+  static void pointer(TextWriter& writer, _::PointerReader ptr) {
+    writer.writeStruct<T>(ptr.getStruct(nullptr));
+  }
+};
+
+template <typename T>
+struct TextWriter::Write<List<T>, Kind::LIST> {
+  static void value(TextWriter& writer, typename List<T>::Reader value) {
+    writer.list<T>(value);
+  }
+  static void pointer(TextWriter& writer, _::PointerReader ptr) {
+    writer.list<T>(_::PointerHelpers<List<T>>::get(ptr));
+  }
+};
+
+template <typename T>
+struct TextWriter::Write<T, Kind::INTERFACE> {
+  template <typename U>
+  static void value(TextWriter& writer, U&&) { writer.placeholder("<external capability>"); }
+  static void pointer(TextWriter& writer, _::PointerReader) {
+    writer.placeholder("<external capability>");
+  }
+};
+
+template <typename T>
+struct TextWriter::Write<T, Kind::OTHER> {
+  static void pointer(TextWriter& writer, _::PointerReader) {
+    writer.placeholder("<opaque pointer>");
+  }
+};
+
+template <typename T>
+kj::String toText(Reader<T> reader) {
+  return TextWriter(TextWriter::Format::TEXT).write(reader).finish();
+}
+
+template <typename T>
+kj::String toJson(Reader<T> reader) {
+  return TextWriter(TextWriter::Format::JSON).write(reader).finish();
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_TEXT_H_
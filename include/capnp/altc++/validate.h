@@ -0,0 +1,523 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_VALIDATE_H_
+#define CAPNP_ALTCXX_VALIDATE_H_
+
+// Checks a whole message against its schema up front, so it can then be read without the checks
+// and traversal accounting every access through a regular Reader pays.
+
+#include <string.h>
+#include <atomic>
+#include <capnp/any.h>
+#include <capnp/endian.h>
+#include <capnp/message.h>
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include "parallel.h"
+
+namespace capnp {
+namespace altcxx {
+
+class MessageValidator {
+  // Walks every pointer reachable from the root of a message, as described by the generated
+  // _visit() of each struct, and throws if any of them points out of its segment, to something
+  // other than what the schema says, or deeper than the nesting limit.  Data fields need no
+  // checks, as they're read as their defaults past the end of a struct's data section.
+  // AnyPointer fields only get their bounds checked.
+  //
+  // Like a Reader, the validator charges every struct and list to a traversal limit, so
+  // messages which point to the same data many times can't make it do unbounded work.  Given a
+  // pool, it splits struct lists and pointer lists of at least `parallelThreshold` elements
+  // between the pool's threads.
+
+public:
+  struct Options {
+    uint64_t traversalLimitInWords;
+    uint nestingLimit;
+    WorkStealingPool* pool;
+    uint parallelThreshold;
+
+    Options()
+        : traversalLimitInWords(8 * 1024 * 1024), nestingLimit(64), pool(nullptr),
+          parallelThreshold(4096) {}
+  };
+
+  explicit MessageValidator(MessageReader& message, Options options = Options())
+      : options(options), budget(options.traversalLimitInWords) {
+    for (uint id = 0;; id++) {
+      auto segment = message.getSegment(id);
+      if (segment == nullptr) break;
+      segments.add(segment);
+    }
+  }
+
+  KJ_DISALLOW_COPY(MessageValidator);
+
+  template <typename T>
+  void validate() {
+    KJ_REQUIRE(segments.size() > 0 && segments[0].size() > 0, "Message has no root pointer.");
+    Check<T>::pointer(*this, Location { 0, 0 }, 0, options.pool != nullptr);
+  }
+
+  bool hasFarPointers() const { return farPointers.load(std::memory_order_relaxed); }
+
+private:
+  enum ElementSize: uint8_t {
+    VOID, BIT, BYTE, TWO_BYTES, FOUR_BYTES, EIGHT_BYTES, POINTER, INLINE_COMPOSITE
+  };
+
+  struct Location {
+    uint segment;
+    uint64_t index;  // In words.
+  };
+
+  struct Target {
+    enum Kind { NONE, STRUCT, LIST, CAPABILITY } kind;
+    Location location;
+    uint32_t upper;  // The upper half of the pointer, or of the landing pad's tag.
+  };
+
+  struct Struct {
+    uint segment;
+    const byte* data;
+    uint64_t dataBytes;
+    uint64_t pointers;  // Index of the first pointer.
+    uint pointerCount;
+
+    uint16_t discriminant(uint offset) const {
+      if ((offset + 1) * sizeof(uint16_t) > dataBytes) return 0;
+      return reinterpret_cast<const _::WireValue<uint16_t>*>(data)[offset].get();
+    }
+  };
+
+  struct ListInfo {
+    Location elements;
+    uint64_t count;
+    ElementSize size;
+    uint64_t dataBits;  // Per element.
+    uint pointerCount;  // Per element.
+    uint64_t step;      // Words per element, for INLINE_COMPOSITE lists.
+  };
+
+  Options options;
+  kj::Vector<kj::ArrayPtr<const word>> segments;
+  std::atomic<uint64_t> budget;
+  std::atomic<bool> farPointers{false};
+
+  template <typename T, Kind k = kind<T>()>
+  struct Check;
+  template <typename T, Kind k = kind<T>()>
+  struct Element;
+
+  static uint32_t lowerHalf(const word* ptr) {
+    return reinterpret_cast<const _::WireValue<uint32_t>*>(ptr)[0].get();
+  }
+  static uint32_t upperHalf(const word* ptr) {
+    return reinterpret_cast<const _::WireValue<uint32_t>*>(ptr)[1].get();
+  }
+
+  const word* at(Location location) const {
+    return segments[location.segment].begin() + location.index;
+  }
+
+  void requireBounds(Location location, uint64_t words) const {
+    uint64_t size = segments[location.segment].size();
+    KJ_REQUIRE(location.index <= size && words <= size - location.index,
+               "Message contains out-of-bounds pointer.");
+  }
+
+  void charge(uint64_t words) {
+    uint64_t left = budget.load(std::memory_order_relaxed);
+    do {
+      KJ_REQUIRE(left >= words, "Exceeded message traversal limit.");
+    } while (!budget.compare_exchange_weak(left, left - words, std::memory_order_relaxed));
+  }
+
+  void checkDepth(uint depth) const {
+    KJ_REQUIRE(depth < options.nestingLimit, "Message is too deeply nested.");
+  }
+
+  Target resolve(Location pointer) {
+    const word* ptr = at(pointer);
+    uint32_t lower = lowerHalf(ptr);
+    uint32_t upper = upperHalf(ptr);
+    if (lower == 0 && upper == 0) return Target { Target::NONE, pointer, 0 };
+
+    switch (lower & 3) {
+      case 0:
+      case 1: {
+        int64_t target = int64_t(pointer.index) + 1 + (static_cast<int32_t>(lower) >> 2);
+        KJ_REQUIRE(target >= 0, "Message contains out-of-bounds pointer.");
+        return Target { (lower & 3) == 0 ? Target::STRUCT : Target::LIST,
+                        Location { pointer.segment, uint64_t(target) }, upper };
+      }
+
+      case 2: {
+        farPointers.store(true, std::memory_order_relaxed);
+        KJ_REQUIRE(upper < segments.size(), "Message contains far pointer to unknown segment.");
+        Location pad { upper, lower >> 3 };
+        if ((lower & 4) == 0) {
+          requireBounds(pad, 1);
+          uint32_t padLower = lowerHalf(at(pad));
+          KJ_REQUIRE((padLower & 3) < 2 || (padLower == 0 && upperHalf(at(pad)) == 0),
+                     "Far pointer's landing pad is not a struct or list pointer.");
+          return resolve(pad);
+        } else {
+          requireBounds(pad, 2);
+          uint32_t padLower = lowerHalf(at(pad));
+          uint32_t padUpper = upperHalf(at(pad));
+          KJ_REQUIRE((padLower & 7) == 2, "Double-far landing pad is not a plain far pointer.");
+          KJ_REQUIRE(padUpper < segments.size(),
+                     "Message contains far pointer to unknown segment.");
+          const word* tag = at(pad) + 1;
+          uint32_t tagLower = lowerHalf(tag);
+          KJ_REQUIRE((tagLower & 3) < 2 && (tagLower >> 2) == 0,
+                     "Double-far landing pad's tag is not a struct or list pointer.");
+          return Target { (tagLower & 3) == 0 ? Target::STRUCT : Target::LIST,
+                          Location { padUpper, padLower >> 3 }, upperHalf(tag) };
+        }
+      }
+
+      default:
+        KJ_REQUIRE(lower == 3, "Message contains unknown pointer type.");
+        return Target { Target::CAPABILITY, pointer, upper };
+    }
+  }
+
+  Struct structAt(const Target& target, uint depth) {
+    KJ_REQUIRE(target.kind == Target::STRUCT, "Message contains non-struct pointer where struct "
+               "pointer was expected.");
+    checkDepth(depth);
+    uint dataWords = target.upper & 0xffff;
+    uint pointerCount = target.upper >> 16;
+    requireBounds(target.location, dataWords + pointerCount);
+    charge(kj::max(1u, dataWords + pointerCount));
+    return Struct { target.location.segment,
+                    reinterpret_cast<const byte*>(at(target.location)), dataWords * sizeof(word),
+                    target.location.index + dataWords, pointerCount };
+  }
+
+  ListInfo listAt(const Target& target, uint depth) {
+    KJ_REQUIRE(target.kind == Target::LIST, "Message contains non-list pointer where list "
+               "pointer was expected.");
+    checkDepth(depth);
+    static const uint BITS[] = { 0, 1, 8, 16, 32, 64, 0, 0 };
+
+    ListInfo list;
+    list.size = static_cast<ElementSize>(target.upper & 7);
+    list.elements = target.location;
+    if (list.size == INLINE_COMPOSITE) {
+      uint64_t wordCount = target.upper >> 3;
+      requireBounds(target.location, wordCount + 1);
+      const word* tag = at(target.location);
+      KJ_REQUIRE((lowerHalf(tag) & 3) == 0, "INLINE_COMPOSITE list's tag is not a struct.");
+      list.count = lowerHalf(tag) >> 2;
+      list.dataBits = (upperHalf(tag) & 0xffff) * 64;
+      list.pointerCount = upperHalf(tag) >> 16;
+      list.step = list.dataBits / 64 + list.pointerCount;
+      KJ_REQUIRE(list.count * list.step <= wordCount,
+                 "INLINE_COMPOSITE list's elements overrun its word count.");
+      list.elements.index++;
+      charge(kj::max(list.count, wordCount));
+    } else {
+      list.count = target.upper >> 3;
+      list.dataBits = BITS[list.size];
+      list.pointerCount = list.size == POINTER ? 1 : 0;
+      list.step = 0;
+      uint64_t words = (list.count * (list.dataBits + list.pointerCount * 64) + 63) / 64;
+      requireBounds(target.location, words);
+      // Void lists take no space, but reading them still costs.
+      charge(kj::max(list.count, words));
+    }
+    return list;
+  }
+
+  void requireElements(const ListInfo& list, ElementSize expected) {
+    // The same compatibility rules as capnp's reader: lists of bigger elements can be read as
+    // lists of smaller ones and any non-bit list as a struct list, for schema evolution.
+    switch (expected) {
+      case VOID:
+        break;
+      case BIT:
+        KJ_REQUIRE(list.size == BIT, "Found non-bit list where bit list was expected.");
+        break;
+      case BYTE:
+      case TWO_BYTES:
+      case FOUR_BYTES:
+      case EIGHT_BYTES: {
+        static const uint BITS[] = { 0, 1, 8, 16, 32, 64, 0, 0 };
+        KJ_REQUIRE(list.size != BIT && list.dataBits >= BITS[expected],
+                   "Found list of smaller elements than expected.");
+        break;
+      }
+      case POINTER:
+        KJ_REQUIRE(list.size != BIT && list.pointerCount >= 1,
+                   "Found list without pointers where pointer list was expected.");
+        break;
+      case INLINE_COMPOSITE:
+        KJ_REQUIRE(list.size != BIT, "Found bit list where struct list was expected.");
+        break;
+    }
+  }
+
+  Struct elementAt(const ListInfo& list, uint64_t i) const {
+    if (list.size == INLINE_COMPOSITE) {
+      Location location { list.elements.segment, list.elements.index + i * list.step };
+      return Struct { location.segment, reinterpret_cast<const byte*>(at(location)),
+                      list.dataBits / 8, location.index + list.dataBits / 64, list.pointerCount };
+    } else if (list.size == POINTER) {
+      return Struct { list.elements.segment, nullptr, 0, list.elements.index + i, 1 };
+    } else {
+      return Struct { list.elements.segment,
+                      reinterpret_cast<const byte*>(at(list.elements)) + i * list.dataBits / 8,
+                      list.dataBits / 8, 0, 0 };
+    }
+  }
+
+  Location elementPointer(const ListInfo& list, uint64_t i) const {
+    if (list.size == INLINE_COMPOSITE) {
+      return Location { list.elements.segment,
+                        list.elements.index + i * list.step + list.dataBits / 64 };
+    }
+    return Location { list.elements.segment, list.elements.index + i };
+  }
+
+  template <typename Func>
+  void forEach(const ListInfo& list, bool mayFork, Func&& func) {
+    // Calls func(index, mayFork) for each element, on the pool if the list is long enough.
+    if (mayFork && list.count >= options.parallelThreshold) {
+      uint chunk = options.parallelThreshold / 4 + 1;
+      uint chunks = (list.count + chunk - 1) / chunk;
+      options.pool->run(chunks, [&](uint task) {
+        uint64_t end = kj::min(list.count, uint64_t(task + 1) * chunk);
+        for (uint64_t i = uint64_t(task) * chunk; i < end; i++) {
+          func(i, false);
+        }
+      });
+    } else {
+      for (uint64_t i = 0; i < list.count; i++) {
+        func(i, mayFork);
+      }
+    }
+  }
+
+  template <typename T>
+  void walkStruct(const Struct& s, uint depth, bool mayFork) {
+    Walker walker(*this, s, depth, mayFork);
+    T::_visit(walker);
+  }
+
+  void walkAny(Location pointer, uint depth) {
+    Target target = resolve(pointer);
+    switch (target.kind) {
+      case Target::NONE:
+      case Target::CAPABILITY:
+        break;
+      case Target::STRUCT: {
+        Struct s = structAt(target, depth);
+        for (uint i = 0; i < s.pointerCount; i++) {
+          walkAny(Location { s.segment, s.pointers + i }, depth + 1);
+        }
+        break;
+      }
+      case Target::LIST: {
+        ListInfo list = listAt(target, depth);
+        if (list.pointerCount > 0) {
+          for (uint64_t i = 0; i < list.count; i++) {
+            Struct element = elementAt(list, i);
+            for (uint j = 0; j < element.pointerCount; j++) {
+              walkAny(Location { element.segment, element.pointers + j }, depth + 1);
+            }
+          }
+        }
+        break;
+      }
+    }
+  }
+
+  class Walker {
+    // Visitor for _visit(), checking the pointer fields of one struct.
+  public:
+    Walker(MessageValidator& validator, const Struct& s, uint depth, bool mayFork)
+        : validator(validator), s(s), depth(depth), mayFork(mayFork) {}
+
+    template <typename T>
+    void field(uint offset) {
+      if (offset < s.pointerCount) {
+        Check<T>::pointer(validator, Location { s.segment, s.pointers + offset }, depth + 1,
+                          mayFork);
+      }
+    }
+
+    template <typename T>
+    void unionField(uint offset, uint discrimOffset, uint16_t value) {
+      if (s.discriminant(discrimOffset) == value) field<T>(offset);
+    }
+
+    template <typename G>
+    void group() { G::_visit(*this); }
+
+    template <typename G>
+    void unionGroup(uint discrimOffset, uint16_t value) {
+      if (s.discriminant(discrimOffset) == value) G::_visit(*this);
+    }
+
+  private:
+    MessageValidator& validator;
+    Struct s;
+    uint depth;
+    bool mayFork;
+  };
+};
+
+template <typename T>
+struct MessageValidator::Check<T, Kind::STRUCT> {
+  static void pointer(MessageValidator& v, Location pointer, uint depth, bool mayFork) {
+    Target target = v.resolve(pointer);
+    if (target.kind == Target::NONE) return;
+    v.walkStruct<T>(v.structAt(target, depth), depth, mayFork);
+  }
+};
+
+template <typename T>
+struct MessageValidator::Check<T, Kind::BLOB> {
+  static void pointer(MessageValidator& v, Location pointer, uint depth, bool) {
+    Target target = v.resolve(pointer);
+    if (target.kind == Target::NONE) return;
+    ListInfo list = v.listAt(target, depth);
+    KJ_REQUIRE(list.size == BYTE, "Message contains non-byte list where blob was expected.");
+    if (kj::isSameType<T, Text>()) {
+      KJ_REQUIRE(list.count > 0 &&
+                 reinterpret_cast<const byte*>(v.at(list.elements))[list.count - 1] == 0,
+                 "Message contains text that is not NUL-terminated.");
+    }
+  }
+};
+
+template <typename T>
+struct MessageValidator::Check<T, Kind::INTERFACE> {
+  static void pointer(MessageValidator& v, Location pointer, uint, bool) {
+    auto kind = v.resolve(pointer).kind;
+    KJ_REQUIRE(kind == Target::NONE || kind == Target::CAPABILITY,
+               "Message contains non-capability pointer where capability pointer was expected.");
+  }
+};
+
+template <typename T>
+struct MessageValidator::Check<T, Kind::OTHER> {
+  static void pointer(MessageValidator& v, Location pointer, uint depth, bool) {
+    v.walkAny(pointer, depth);
+  }
+};
+
+template <typename T>
+struct MessageValidator::Check<List<T>, Kind::LIST> {
+  static void pointer(MessageValidator& v, Location pointer, uint depth, bool mayFork) {
+    Target target = v.resolve(pointer);
+    if (target.kind == Target::NONE) return;
+    ListInfo list = v.listAt(target, depth);
+    v.requireElements(list, Element<T>::SIZE);
+    Element<T>::walk(v, list, depth, mayFork);
+  }
+};
+
+template <typename T>
+struct MessageValidator::Element<T, Kind::PRIMITIVE> {
+  static constexpr ElementSize SIZE =
+      kj::isSameType<T, Void>() ? VOID : kj::isSameType<T, bool>() ? BIT :
+      sizeof(T) == 1 ? BYTE : sizeof(T) == 2 ? TWO_BYTES :
+      sizeof(T) == 4 ? FOUR_BYTES : EIGHT_BYTES;
+  static void walk(MessageValidator&, const ListInfo&, uint, bool) {}
+};
+
+template <typename T>
+struct MessageValidator::Element<T, Kind::ENUM> {
+  static constexpr ElementSize SIZE = TWO_BYTES;
+  static void walk(MessageValidator&, const ListInfo&, uint, bool) {}
+};
+
+template <typename T>
+struct MessageValidator::Element<T, Kind::STRUCT> {
+  static constexpr ElementSize SIZE = INLINE_COMPOSITE;
+  static void walk(MessageValidator& v, const ListInfo& list, uint depth, bool mayFork) {
+    v.forEach(list, mayFork, [&](uint64_t i, bool mayForkElement) {
+      v.walkStruct<T>(v.elementAt(list, i), depth, mayForkElement);
+    });
+  }
+};
+
+template <typename T, Kind k>
+struct MessageValidator::Element {
+  // Lists of pointers.
+  static constexpr ElementSize SIZE = POINTER;
+  static void walk(MessageValidator& v, const ListInfo& list, uint depth, bool mayFork) {
+    v.forEach(list, mayFork, [&](uint64_t i, bool mayForkElement) {
+      Check<T>::pointer(v, v.elementPointer(list, i), depth + 1, mayForkElement);
+    });
+  }
+};
+
+template <typename T>
+class TrustedMessage {
+  // A message that passed MessageValidator, read through capnp's unchecked reader, which does
+  // no bounds checks and keeps no traversal count.  A single segment message without far
+  // pointers is read in place, so the MessageReader's segments must outlive the TrustedMessage;
+  // anything else is first copied into one flat array.
+  //
+  // Capabilities can't be read this way.
+
+public:
+  explicit TrustedMessage(MessageReader& message,
+                          MessageValidator::Options options = MessageValidator::Options()) {
+    MessageValidator validator(message, options);
+    validator.template validate<T>();
+
+    auto first = message.getSegment(0);
+    if (message.getSegment(1) == nullptr && !validator.hasFarPointers()) {
+      root = first.begin();
+    } else {
+      auto source = message.getRoot<AnyPointer>();
+      copy = kj::heapArray<word>(source.targetSize().wordCount + 1);
+      memset(copy.begin(), 0, copy.size() * sizeof(word));
+      FlatMessageBuilder builder(copy);
+      builder.getRoot<AnyPointer>().set(source);
+      builder.requireFilled();
+      root = copy.begin();
+    }
+  }
+
+  KJ_DISALLOW_COPY(TrustedMessage);
+
+  typename T::Reader getRoot() const { return readMessageUnchecked<T>(root); }
+
+private:
+  kj::Array<word> copy;
+  const word* root;
+};
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_VALIDATE_H_
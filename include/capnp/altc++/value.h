@@ -0,0 +1,161 @@
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNP_ALTCXX_VALUE_H_
+#define CAPNP_ALTCXX_VALUE_H_
+
+#include <string.h>
+#include <kj/debug.h>
+#include <capnp/list.h>
+#include "impl.h"
+#include "native.h"
+
+namespace capnp {
+namespace altcxx {
+
+// Support for the `Value` types generated for structs whose fields are all numbers and enums.  A
+// Value holds exactly the struct's data section, so it's trivially copyable, can be stored in
+// containers and compared bytewise, and moves to and from messages with memcpy.
+
+template <typename T>
+constexpr _::Mask<T> maskValue(T value, _::Mask<T> mask) {
+  return static_cast<_::Mask<T>>(static_cast<_::Mask<T>>(value) ^ mask);
+}
+
+inline uint32_t maskValue(float value, uint32_t mask) { return _::mask<float>(value, mask); }
+inline uint64_t maskValue(double value, uint64_t mask) { return _::mask<double>(value, mask); }
+
+template <typename T, _::Mask<T> mask = 0>
+class ValueField {
+  // One field of a Value, stored as it is in a data section: little-endian and XORed with the
+  // field's default.  Assigning one ValueField to another copies the field.
+
+  typedef _::Mask<T> Bits;
+
+public:
+  constexpr ValueField(): wire(0) {}
+  explicit constexpr ValueField(T value): wire(encode(value)) {}
+
+  T get() const { return _::unmask<T>(swapUnlessWireOrder(wire), mask); }
+  void set(T value) { wire = encode(value); }
+
+  operator T() const { return get(); }
+  ValueField& operator = (T value) { set(value); return *this; }
+
+private:
+  Bits wire;
+
+  static constexpr Bits encode(T value) {
+    // Only a constant expression for integers and enums, as floats can't be reinterpreted as
+    // bits at compile time.
+    return WIRE_BYTE_ORDER ? maskValue(value, mask) : swapUnlessWireOrder(maskValue(value, mask));
+  }
+
+  static Bits swapUnlessWireOrder(Bits bits) {
+    if (WIRE_BYTE_ORDER) return bits;
+    _::WireValue<Bits> swapped;
+    swapped.set(bits);
+    memcpy(&bits, &swapped, sizeof(bits));
+    return bits;
+  }
+};
+
+template <typename V>
+inline bool sameValue(const V& a, const V& b) {
+  // Values have no implicit padding, so equal fields mean equal bytes (except that floats
+  // compare bytewise, so 0.0 != -0.0 and NaN == NaN).
+  return memcmp(&a, &b, sizeof(V)) == 0;
+}
+
+struct ValueHash {
+  // FNV-1a over a Value's bytes, for unordered containers.
+
+  template <typename V>
+  size_t operator()(const V& value) const {
+    auto bytes = reinterpret_cast<const byte*>(&value);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(V); i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return static_cast<size_t>(hash);
+  }
+};
+
+template <typename T>
+void copyValues(typename List<T>::Reader from, kj::ArrayPtr<typename T::Value> to) {
+  // Copies a struct list into an array of Values, with a single memcpy if the list's elements
+  // are exactly the size of a Value.
+
+  typedef typename T::Value Value;
+  KJ_REQUIRE(from.size() == to.size(), "List and array sizes differ.");
+  uint size = from.size();
+  if (size == 0) return;
+
+  auto first = from[0];
+  auto data = ReaderImpl::asStruct(&first).getDataSectionAsBlob();
+  if (size > 1 && data.size() == sizeof(Value)) {
+    auto second = from[1];
+    if (ReaderImpl::asStruct(&second).getDataSectionAsBlob().begin() == data.end()) {
+      memcpy(to.begin(), data.begin(), size * sizeof(Value));
+      return;
+    }
+  }
+
+  // Elements from an older or newer version of the struct are copied one at a time.
+  for (uint i = 0; i < size; i++) {
+    auto element = from[i];
+    copyDataSection(ReaderImpl::asStruct(&element), &to[i], sizeof(Value));
+  }
+}
+
+template <typename T>
+void copyValues(kj::ArrayPtr<const typename T::Value> from, typename List<T>::Builder to) {
+  // Copies an array of Values into a struct list, with a single memcpy if the list's elements
+  // are exactly the size of a Value.
+
+  typedef typename T::Value Value;
+  KJ_REQUIRE(from.size() == to.size(), "List and array sizes differ.");
+  uint size = to.size();
+  if (size == 0) return;
+
+  auto first = to[0];
+  auto data = BuilderImpl::asStruct(&first).getDataSectionAsBlob();
+  if (size > 1 && data.size() == sizeof(Value)) {
+    auto second = to[1];
+    if (BuilderImpl::asStruct(&second).getDataSectionAsBlob().begin() == data.end()) {
+      memcpy(data.begin(), from.begin(), size * sizeof(Value));
+      return;
+    }
+  }
+
+  for (uint i = 0; i < size; i++) {
+    auto element = to[i];
+    copyDataSection(&from[i], BuilderImpl::asStruct(&element), sizeof(Value));
+  }
+}
+
+} // namespace altcxx
+} // namespace capnp
+
+#endif // CAPNP_ALTCXX_VALUE_H_
@@ -43,6 +43,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <fstream>
+#include <sstream>
 
 #ifndef VERSION
 #define VERSION "(unknown)"
@@ -54,6 +56,16 @@ namespace {
 
 static constexpr uint64_t NAMESPACE_ANNOTATION_ID = 0xb9c6f99ebf805f2cull;
 static constexpr uint64_t RENAME_ANNOTATION_ID    = 0xa700d7fb1907fdd8ull;
+static constexpr uint64_t COLD_ANNOTATION_ID      = 0xcdb6f9369d9d8fa6ull;
+static constexpr uint64_t MIRROR_ANNOTATION_ID    = 0x96b6a7f59e6887f2ull;
+static constexpr uint64_t PROJECTIONS_ANNOTATION_ID = 0xa86f0418ae4d5c63ull;
+static constexpr uint64_t INSTRUMENT_ANNOTATION_ID = 0x990dd25c55305a2bull;
+static constexpr uint64_t EXECUTOR_ANNOTATION_ID = 0xc2162185baaff71cull;
+static constexpr uint64_t CACHEABLE_ANNOTATION_ID = 0xcde8afa754911690ull;
+static constexpr uint64_t PAYLOAD_ANNOTATION_ID = 0xc3492b3d0627702full;
+
+static constexpr uint CACHE_LINE_WORDS = 8;
+static constexpr uint HOT_ACCESS_PERCENT = 90;
 
 static constexpr const char* FIELD_SIZE_NAMES[] = {
   "VOID", "BIT", "BYTE", "TWO_BYTES", "FOUR_BYTES", "EIGHT_BYTES", "POINTER", "INLINE_COMPOSITE"
@@ -63,6 +75,47 @@ bool hasDiscriminantValue(const schema::Field::Reader& reader) {
   return reader.getDiscriminantValue() != schema::Field::NO_DISCRIMINANT;
 }
 
+bool hasAnnotation(const schema::Field::Reader& reader, uint64_t id) {
+  for (auto annotation: reader.getAnnotations()) {
+    if (annotation.getId() == id) return true;
+  }
+  return false;
+}
+
+kj::StringPtr propertyNameFor(const schema::Field::Reader& reader) {
+  for (auto annotation: reader.getAnnotations()) {
+    if (annotation.getId() == RENAME_ANNOTATION_ID) {
+      return annotation.getValue().getText();
+    }
+  }
+  return reader.getName();
+}
+
+bool isZero(schema::Value::Reader value) {
+  switch (value.which()) {
+    case schema::Value::VOID: return true;
+    case schema::Value::BOOL: return !value.getBool();
+    case schema::Value::INT8: return value.getInt8() == 0;
+    case schema::Value::INT16: return value.getInt16() == 0;
+    case schema::Value::INT32: return value.getInt32() == 0;
+    case schema::Value::INT64: return value.getInt64() == 0;
+    case schema::Value::UINT8: return value.getUint8() == 0;
+    case schema::Value::UINT16: return value.getUint16() == 0;
+    case schema::Value::UINT32: return value.getUint32() == 0;
+    case schema::Value::UINT64: return value.getUint64() == 0;
+    case schema::Value::FLOAT32: return value.getFloat32() == 0;
+    case schema::Value::FLOAT64: return value.getFloat64() == 0;
+    case schema::Value::ENUM: return value.getEnum() == 0;
+    case schema::Value::TEXT: return !value.hasText();
+    case schema::Value::DATA: return !value.hasData();
+    case schema::Value::LIST: return !value.hasList();
+    case schema::Value::STRUCT: return !value.hasStruct();
+    case schema::Value::INTERFACE: return true;
+    case schema::Value::ANY_POINTER: return !value.hasAnyPointer();
+  }
+  return false;
+}
+
 void enumerateDeps(schema::Type::Reader type, std::set<uint64_t>& deps) {
   switch (type.which()) {
     case schema::Type::STRUCT:
@@ -148,6 +201,12 @@ public:
   kj::MainFunc getMain() {
     return kj::MainBuilder(context, VERSION, "Cap'n Proto alternative c++ plugin",
         "This Cap'n Proto compiler plugin generates C++ classes with property-like fields")
+        .addOptionWithArg({"access-profile"}, KJ_BIND_METHOD(*this, setAccessProfile), "<file>",
+            "Instead of generating code, read per-field access counts from <file> and report "
+            "how the hot fields of each profiled struct are spread over words and cache lines, "
+            "along with a proposed hot/cold split.  Each line of <file> has the form "
+            "\"<struct> <field> <count>\", where <struct> is the scoped name of the struct (e.g. "
+            "\"Person.PhoneNumber\") and <field> may be dotted to name a group member.")
         .callAfterParsing(KJ_BIND_METHOD(*this, run))
         .build();
   }
@@ -158,6 +217,15 @@ private:
   std::unordered_set<uint64_t> usedImports;
   std::map<uint64_t, bool> needsPipelineCache;
   bool hasInterfaces = false;
+  bool hasInstrumentedInterfaces = false;
+  bool hasExecutorMethods = false;
+  bool hasCacheableMethods = false;
+  kj::String accessProfilePath;
+
+  kj::MainBuilder::Validity setAccessProfile(kj::StringPtr path) {
+    accessProfilePath = kj::heapString(path);
+    return true;
+  }
 
   kj::StringTree cppFullName(Schema schema) {
     auto node = schema.getProto();
@@ -237,8 +305,7 @@ private:
         return kj::strTree(" ::capnp::List<", typeName(type.getList().getElementType()), ">");
 
       case schema::Type::ANY_POINTER:
-        // Not used.
-        return kj::strTree();
+        return kj::strTree(" ::capnp::AnyPointer");
     }
     KJ_UNREACHABLE;
   }
@@ -540,24 +607,66 @@ private:
     ANY_POINTER
   };
 
-  FieldText makeFieldText(StructSchema::Field field) {
+  kj::String primitiveDefaultMask(schema::Type::Reader type, schema::Value::Reader value) {
+    // Data fields are stored XORed with their default; this is the mask as a C++ literal, or
+    // empty if the default is zero.
+    switch (type.which()) {
+#define HANDLE_PRIMITIVE(discrim, defaultName, suffix) \
+      case schema::Type::discrim: \
+        if (value.get##defaultName() != 0) { \
+          return kj::str(value.get##defaultName(), #suffix); \
+        } \
+        break;
+
+      HANDLE_PRIMITIVE(BOOL, Bool, );
+      HANDLE_PRIMITIVE(INT8 , Int8 , );
+      HANDLE_PRIMITIVE(INT16, Int16, );
+      HANDLE_PRIMITIVE(INT32, Int32, );
+      HANDLE_PRIMITIVE(INT64, Int64, ll);
+      HANDLE_PRIMITIVE(UINT8 , Uint8 , u);
+      HANDLE_PRIMITIVE(UINT16, Uint16, u);
+      HANDLE_PRIMITIVE(UINT32, Uint32, u);
+      HANDLE_PRIMITIVE(UINT64, Uint64, ull);
+      HANDLE_PRIMITIVE(ENUM, Enum, u);
+#undef HANDLE_PRIMITIVE
+
+      case schema::Type::FLOAT32:
+        if (value.getFloat32() != 0) {
+          uint32_t mask;
+          float floatValue = value.getFloat32();
+          static_assert(sizeof(mask) == sizeof(floatValue), "bug");
+          memcpy(&mask, &floatValue, sizeof(mask));
+          return kj::str(mask, "u");
+        }
+        break;
+
+      case schema::Type::FLOAT64:
+        if (value.getFloat64() != 0) {
+          uint64_t mask;
+          double doubleValue = value.getFloat64();
+          static_assert(sizeof(mask) == sizeof(doubleValue), "bug");
+          memcpy(&mask, &doubleValue, sizeof(mask));
+          return kj::str(mask, "ull");
+        }
+        break;
+
+      default:
+        break;
+    }
+    return nullptr;
+  }
+
+  FieldText makeFieldText(StructSchema::Field field, kj::StringPtr impl = "Impl") {
     auto proto = field.getProto();
 
     kj::StringPtr name = proto.getName();
-    kj::StringPtr propertyName = name;
+    kj::StringPtr propertyName = propertyNameFor(proto);
     kj::String titleCase = toTitleCase(name);
 
     bool inUnion = hasDiscriminantValue(proto);
     kj::StringTree maybeInUnion;
     kj::StringTree unionCheck;
 
-    for (auto annotation: proto.getAnnotations()) {
-      if (annotation.getId() == RENAME_ANNOTATION_ID) {
-        propertyName = annotation.getValue().getText();
-        break;
-      }
-    }
-
     if (inUnion) {
       auto containingStruct = field.getContainingStruct();
       auto discrimOff = containingStruct.getProto().getStruct().getDiscriminantOffset();
@@ -576,7 +685,7 @@ private:
     if (proto.isGroup()) {
       return FieldText {
         kj::mv(unionCheck),
-        kj::strTree(prefix, "GroupProperty<Impl, ", titleCase, kj::mv(propertyTail)),
+        kj::strTree(prefix, "GroupProperty<", impl, ", ", titleCase, kj::mv(propertyTail)),
 
         hasDiscriminantValue(proto) ? kj::strTree() :
           kj::strTree(prefix, "GroupPipelineProperty<Op, ", titleCase, "> ", propertyName, ";\n"),
@@ -585,6 +694,11 @@ private:
 
     auto slot = proto.getSlot();
 
+    if (hasAnnotation(proto, COLD_ANNOTATION_ID) && !slot.getType().isStruct()) {
+      context.exitError(kj::str(field.getContainingStruct().getProto().getDisplayName(), ".",
+                                name, ": $cold can only be applied to struct fields"));
+    }
+
     FieldKind kind = FieldKind::PRIMITIVE;
     kj::String type = typeName(slot.getType()).flatten();
     kj::String defaultMask;    // primitives only
@@ -598,45 +712,19 @@ private:
         kind = FieldKind::PRIMITIVE;
         break;
 
-#define HANDLE_PRIMITIVE(discrim, typeName, defaultName, suffix) \
-      case schema::Type::discrim: \
-        kind = FieldKind::PRIMITIVE; \
-        if (defaultBody.get##defaultName() != 0) { \
-          defaultMask = kj::str(defaultBody.get##defaultName(), #suffix); \
-        } \
-        break;
-
-      HANDLE_PRIMITIVE(BOOL, bool, Bool, );
-      HANDLE_PRIMITIVE(INT8 , ::int8_t , Int8 , );
-      HANDLE_PRIMITIVE(INT16, ::int16_t, Int16, );
-      HANDLE_PRIMITIVE(INT32, ::int32_t, Int32, );
-      HANDLE_PRIMITIVE(INT64, ::int64_t, Int64, ll);
-      HANDLE_PRIMITIVE(UINT8 , ::uint8_t , Uint8 , u);
-      HANDLE_PRIMITIVE(UINT16, ::uint16_t, Uint16, u);
-      HANDLE_PRIMITIVE(UINT32, ::uint32_t, Uint32, u);
-      HANDLE_PRIMITIVE(UINT64, ::uint64_t, Uint64, ull);
-#undef HANDLE_PRIMITIVE
-
+      case schema::Type::BOOL:
+      case schema::Type::INT8:
+      case schema::Type::INT16:
+      case schema::Type::INT32:
+      case schema::Type::INT64:
+      case schema::Type::UINT8:
+      case schema::Type::UINT16:
+      case schema::Type::UINT32:
+      case schema::Type::UINT64:
       case schema::Type::FLOAT32:
-        kind = FieldKind::PRIMITIVE;
-        if (defaultBody.getFloat32() != 0) {
-          uint32_t mask;
-          float value = defaultBody.getFloat32();
-          static_assert(sizeof(mask) == sizeof(value), "bug");
-          memcpy(&mask, &value, sizeof(mask));
-          defaultMask = kj::str(mask, "u");
-        }
-        break;
-
       case schema::Type::FLOAT64:
         kind = FieldKind::PRIMITIVE;
-        if (defaultBody.getFloat64() != 0) {
-          uint64_t mask;
-          double value = defaultBody.getFloat64();
-          static_assert(sizeof(mask) == sizeof(value), "bug");
-          memcpy(&mask, &value, sizeof(mask));
-          defaultMask = kj::str(mask, "ull");
-        }
+        defaultMask = primitiveDefaultMask(typeBody, defaultBody);
         break;
 
       case schema::Type::TEXT:
@@ -656,9 +744,7 @@ private:
 
       case schema::Type::ENUM:
         kind = FieldKind::PRIMITIVE;
-        if (defaultBody.getEnum() != 0) {
-          defaultMask = kj::str(defaultBody.getEnum(), "u");
-        }
+        defaultMask = primitiveDefaultMask(typeBody, defaultBody);
         break;
 
       case schema::Type::STRUCT:
@@ -696,14 +782,14 @@ private:
     if (kind == FieldKind::PRIMITIVE) {
       return FieldText {
         kj::mv(unionCheck),
-        kj::strTree(prefix, "PrimitiveProperty<Impl, ", offset, ", ", type,
+        kj::strTree(prefix, "PrimitiveProperty<", impl, ", ", offset, ", ", type,
                     kj::mv(propertyMaskParam), kj::mv(propertyTail))
       };
 
     } else if (kind == FieldKind::INTERFACE) {
       return FieldText {
         kj::mv(unionCheck),
-        kj::strTree(prefix, "InterfaceProperty<Impl, ", offset, ", ",
+        kj::strTree(prefix, "InterfaceProperty<", impl, ", ", offset, ", ",
                     type, kj::mv(propertyTail)),
 
         kj::strTree(hasDiscriminantValue(proto) ? kj::strTree() : kj::strTree(
@@ -713,7 +799,7 @@ private:
     } else if (kind == FieldKind::ANY_POINTER) {
       return FieldText {
         kj::mv(unionCheck),
-        kj::strTree(prefix, "AnyPointerProperty<Impl, ", offset, kj::mv(propertyTail))
+        kj::strTree(prefix, "AnyPointerProperty<", impl, ", ", offset, kj::mv(propertyTail))
       };
 
     } else {
@@ -749,12 +835,17 @@ private:
           break;
       }
 
+      kj::StringTree coldProperties;
+      if (hasAnnotation(proto, COLD_ANNOTATION_ID)) {
+        coldProperties = makeColdProperties(field, impl, offset, type);
+      }
+
       return FieldText {
         kj::mv(unionCheck),
 
-        kj::strTree(prefix, propertyType, "<Impl, ", offset,
+        kj::strTree(prefix, propertyType, "<", impl, ", ", offset,
                     typeBody.isText() ? kj::strTree() : kj::strTree(", ", type),
-                    kj::mv(propertyDefault), kj::mv(propertyTail)),
+                    kj::mv(propertyDefault), kj::mv(propertyTail), kj::mv(coldProperties)),
 
         kj::strTree(kind == FieldKind::STRUCT && !hasDiscriminantValue(proto)
                     ? kj::strTree(prefix, "StructPipelineProperty<Op, ", type,
@@ -764,17 +855,761 @@ private:
     }
   }
 
+  kj::StringTree makeColdProperties(StructSchema::Field field, kj::StringPtr impl, uint offset,
+                                    kj::StringPtr type) {
+    // The side struct's properties are declared in the containing struct, with an Impl which
+    // follows the pointer to the side struct.
+
+    auto proto = field.getProto();
+    auto containingStruct = field.getContainingStruct();
+    auto coldSchema = schemaLoader.get(proto.getSlot().getType().getStruct().getTypeId()).asStruct();
+    auto where = kj::str(containingStruct.getProto().getDisplayName(), ".", proto.getName());
+
+    if (hasDiscriminantValue(proto)) {
+      context.exitError(kj::str(where, ": $cold fields can't be union members"));
+    }
+    if (coldSchema.getProto().getStruct().getDiscriminantCount() > 0) {
+      context.exitError(kj::str(where, ": the struct of a $cold field can't have an unnamed union"));
+    }
+
+    auto coldImpl = kj::str("::capnp::altcxx::ColdImpl<", impl, ", ", offset, ", ", type, ">");
+
+    return kj::strTree(KJ_MAP(f, coldSchema.getFields()) {
+      auto coldProto = f.getProto();
+      if (coldProto.isGroup()) {
+        context.exitError(kj::str(where, ": the struct of a $cold field can't have groups"));
+      }
+
+      for (auto sibling: containingStruct.getFields()) {
+        if (propertyNameFor(sibling.getProto()) == propertyNameFor(coldProto)) {
+          context.exitError(kj::str(where, ": field \"", propertyNameFor(coldProto),
+                                    "\" is already a property of the containing struct"));
+        }
+      }
+
+      return kj::mv(makeFieldText(f, coldImpl).property);
+    });
+  }
+
+  // -----------------------------------------------------------------
+  // $mirror -- plain C++ copies of structs.
+
+  bool isMirrored(StructSchema schema) {
+    // Groups are mirrored along with the struct they belong to.
+    auto proto = schema.getProto();
+    if (proto.getStruct().getIsGroup()) {
+      return isMirrored(schemaLoader.get(proto.getScopeId()).asStruct());
+    }
+    for (auto annotation: proto.getAnnotations()) {
+      if (annotation.getId() == MIRROR_ANNOTATION_ID) return true;
+    }
+    return false;
+  }
+
+  kj::String nativeTypeName(schema::Type::Reader type, kj::StringPtr where, bool isElement) {
+    switch (type.which()) {
+      case schema::Type::TEXT: return kj::str(" ::kj::String");
+      case schema::Type::DATA: return kj::str(" ::kj::Array< ::kj::byte>");
+
+      case schema::Type::LIST:
+        return kj::str(" ::kj::Array<",
+                       nativeTypeName(type.getList().getElementType(), where, true), ">");
+
+      case schema::Type::STRUCT: {
+        auto schema = schemaLoader.get(type.getStruct().getTypeId()).asStruct();
+        if (!isMirrored(schema)) {
+          context.exitError(kj::str(where, ": ", schema.getProto().getDisplayName(),
+                                    " must also be annotated $mirror"));
+        }
+        // Struct fields may be null (and types may be recursive), so only list elements are
+        // mirrored by value.
+        auto native = kj::str(cppFullName(schema), "::Native");
+        return isElement ? kj::mv(native) : kj::str(" ::kj::Own<", native, ">");
+      }
+
+      case schema::Type::INTERFACE:
+      case schema::Type::ANY_POINTER:
+        context.exitError(kj::str(where, ": $mirror doesn't support capabilities or AnyPointer"));
+
+      default:
+        return typeName(type).flatten();
+    }
+  }
+
+  bool canCopyDataSection(StructSchema schema) {
+    // The data section can be copied as a whole if the mirror's data members can be laid out
+    // exactly like it: no unions or groups sharing it, no bools, and no XORed defaults.
+
+    auto structNode = schema.getProto().getStruct();
+    if (structNode.getIsGroup() || structNode.getDiscriminantCount() > 0) return false;
+
+    bool anyData = false;
+    for (auto field: schema.getFields()) {
+      auto proto = field.getProto();
+      if (proto.isGroup()) return false;
+      auto slot = proto.getSlot();
+      auto whichType = slot.getType().which();
+      if (sectionFor(whichType) != Section::DATA) continue;
+      if (whichType == schema::Type::BOOL || !isZero(slot.getDefaultValue())) return false;
+      anyData = true;
+    }
+    return anyData;
+  }
+
+  struct MirrorText {
+    kj::StringTree nativeDef;
+    kj::StringTree methods;
+  };
+
+  MirrorText makeMirrorText(kj::StringPtr fullName, StructSchema schema) {
+    auto structNode = schema.getProto().getStruct();
+    bool copyData = canCopyDataSection(schema);
+    uint dataBytes = structNode.getDataWordCount() * 8;
+
+    kj::Vector<kj::StringTree> dataMembers;
+    kj::Vector<kj::StringTree> members;
+    kj::Vector<kj::StringTree> dataDecode;
+    kj::Vector<kj::StringTree> decode;
+    kj::Vector<kj::StringTree> dataEncode;
+    kj::Vector<kj::StringTree> encode;
+
+    if (structNode.getDiscriminantCount() > 0) {
+      members.add(kj::strTree("  Which which;\n"));
+      decode.add(kj::strTree("    _out.which = which();\n"));
+    }
+
+    // With copyData, data members are declared in offset order, padded to match the data section.
+    kj::String lastDataMember;
+    uint dataEnd = 0;
+    if (copyData) {
+      for (auto slot: getSortedSlots(schema)) {
+        if (sectionFor(slot.whichType) != Section::DATA) continue;
+        uint bytes = typeSizeBits(slot.whichType) / 8;
+        uint start = slot.offset * bytes;
+        if (start > dataEnd) {
+          lastDataMember = kj::str("_pad", dataMembers.size());
+          dataMembers.add(kj::strTree("  ::uint8_t ", lastDataMember, "[", start - dataEnd,
+                                      "] = {};\n"));
+        }
+        for (auto field: schema.getFields()) {
+          auto proto = field.getProto();
+          if (proto.getSlot().getType().which() == slot.whichType &&
+              proto.getSlot().getOffset() == slot.offset) {
+            lastDataMember = kj::heapString(propertyNameFor(proto));
+            dataMembers.add(kj::strTree("  ", typeName(proto.getSlot().getType()), " ",
+                                        lastDataMember, ";\n"));
+            break;
+          }
+        }
+        dataEnd = start + bytes;
+      }
+      if (dataEnd < dataBytes) {
+        lastDataMember = kj::str("_pad", dataMembers.size());
+        dataMembers.add(kj::strTree("  ::uint8_t ", lastDataMember, "[", dataBytes - dataEnd,
+                                    "] = {};\n"));
+      }
+    }
+
+    for (auto field: schema.getFields()) {
+      auto proto = field.getProto();
+      auto name = propertyNameFor(proto);
+      auto where = kj::str(schema.getProto().getDisplayName(), ".", proto.getName());
+      bool inUnion = hasDiscriminantValue(proto);
+      auto decodeIf = inUnion ?
+          kj::str("if (_out.which == ", toUpperCase(proto.getName()), ") ") : kj::str();
+      auto encodeIf = inUnion ?
+          kj::str("if (_in.which == ", toUpperCase(proto.getName()), ") ") : kj::str();
+
+      if (proto.isGroup()) {
+        members.add(kj::strTree("  ", toTitleCase(proto.getName()), "::Native ", name, ";\n"));
+        decode.add(kj::strTree("    ", decodeIf, name, ".get().copyTo(_out.", name, ");\n"));
+        encode.add(kj::strTree("    ", encodeIf, name, inUnion ? ".init()" : ".get()",
+                               ".copyFrom(_in.", name, ");\n"));
+        continue;
+      }
+
+      auto slot = proto.getSlot();
+      auto type = slot.getType();
+      auto codec = kj::str("::capnp::altcxx::NativeCodec<", typeName(type), ">");
+
+      switch (sectionFor(type.which())) {
+        case Section::NONE:
+          if (inUnion) {
+            encode.add(kj::strTree("    ", encodeIf, name, " = ::capnp::VOID;\n"));
+          }
+          break;
+
+        case Section::DATA:
+          if (!copyData) {
+            members.add(kj::strTree("  ", typeName(type), " ", name, ";\n"));
+          }
+          (copyData ? dataDecode : decode).add(
+              kj::strTree("    ", decodeIf, "_out.", name, " = ", name, ".get();\n"));
+          (copyData ? dataEncode : encode).add(
+              kj::strTree("    ", encodeIf, name, " = _in.", name, ";\n"));
+          break;
+
+        case Section::POINTERS: {
+          members.add(kj::strTree("  ", nativeTypeName(type, where, false), " ", name, ";\n"));
+
+          // Empty values are left null, unless that would read back as a non-empty default or
+          // leave a union member unset.
+          auto setIf = inUnion ? kj::mv(encodeIf) : isZero(slot.getDefaultValue()) ?
+              kj::str("if (_in.", name, type.isStruct() ? ".get() != nullptr) " : ".size() > 0) ") :
+              kj::str();
+
+          if (type.isStruct()) {
+            decode.add(kj::strTree(
+                "    ", decodeIf, "_out.", name, " = ", codec, "::decodeOwn(", name, ");\n"));
+            encode.add(kj::strTree(
+                "    ", setIf, "{\n"
+                "      auto _builder = ", name, ".init();\n"
+                "      if (_in.", name, ".get() != nullptr) _builder.copyFrom(*_in.", name, ");\n"
+                "    }\n"));
+          } else {
+            decode.add(kj::strTree(
+                "    ", decodeIf, "_out.", name, " = ", codec, "::decode(", name,
+                ".asReader());\n"));
+            if (type.isList()) {
+              encode.add(kj::strTree(
+                  "    ", setIf, codec, "::fill(", name, ".init(_in.", name, ".size()), _in.",
+                  name, ");\n"));
+            } else {
+              encode.add(kj::strTree(
+                  "    ", setIf, name, " = ", codec, "::encode(_in.", name, ");\n"));
+            }
+          }
+          break;
+        }
+      }
+    }
+
+    auto dataSizeText = kj::str(dataBytes);
+
+    return MirrorText {
+      kj::strTree(
+          "struct ", fullName, "::Native {\n",
+          dataMembers.releaseAsArray(),
+          members.releaseAsArray(),
+          "};\n",
+          copyData ? kj::strTree(
+              "static_assert(offsetof(", fullName, "::Native, ", lastDataMember, ") + sizeof(",
+              fullName, "::Native::", lastDataMember, ") == ", dataBytes, ",\n"
+              "              \"Native data members must match the data section.\");\n") :
+              kj::strTree(),
+          "\n"),
+
+      kj::strTree(
+          "  void copyTo(Native& _out) {\n",
+          copyData ? kj::strTree(
+              "    if (::capnp::altcxx::WIRE_BYTE_ORDER) {\n"
+              "      ::capnp::altcxx::copyDataSection(\n"
+              "          Impl::asReader(Impl::asStruct(this)), &_out, ", dataSizeText, ");\n"
+              "    } else {\n",
+              dataDecode.releaseAsArray(),
+              "    }\n") : kj::strTree(),
+          decode.releaseAsArray(),
+          "  }\n"
+          "\n"
+          "  template <typename = ::kj::EnableIf<!Impl::CONST>>\n"
+          "  void copyFrom(const Native& _in) {\n",
+          copyData ? kj::strTree(
+              "    if (::capnp::altcxx::WIRE_BYTE_ORDER) {\n"
+              "      ::capnp::altcxx::copyDataSection(&_in, Impl::asStruct(this), ",
+                       dataSizeText, ");\n"
+              "    } else {\n",
+              dataEncode.releaseAsArray(),
+              "    }\n") : kj::strTree(),
+          encode.releaseAsArray(),
+          "  }\n"
+          "\n")
+    };
+  }
+
+  // -----------------------------------------------------------------
+  // Value types for structs of numbers and enums.
+
+  bool hasValueType(StructSchema schema) {
+    // A struct with nothing but numeric and enum fields gets a trivially copyable Value laid out
+    // exactly like its data section.  Bools are left out, as they share bytes.
+
+    auto proto = schema.getProto();
+    auto structNode = proto.getStruct();
+    if (structNode.getIsGroup() || structNode.getDiscriminantCount() > 0 ||
+        structNode.getPointerCount() > 0) {
+      return false;
+    }
+    for (auto nested: proto.getNestedNodes()) {
+      if (nested.getName() == "Value") return false;
+    }
+
+    bool anyData = false;
+    for (auto field: schema.getFields()) {
+      auto fieldProto = field.getProto();
+      if (fieldProto.isGroup()) return false;
+      auto whichType = fieldProto.getSlot().getType().which();
+      if (whichType == schema::Type::BOOL) return false;
+      if (sectionFor(whichType) == Section::DATA) anyData = true;
+    }
+    return anyData;
+  }
+
+  struct ValueText {
+    kj::StringTree valueDef;
+    kj::StringTree methods;
+  };
+
+  ValueText makeValueText(kj::StringPtr fullName, StructSchema schema) {
+    uint dataBytes = schema.getProto().getStruct().getDataWordCount() * 8;
+
+    // Members are declared in offset order, padded to match the data section.
+    kj::Vector<kj::StringTree> members;
+    kj::Vector<kj::StringTree> inits;
+    uint dataEnd = 0;
+    for (auto slot: getSortedSlots(schema)) {
+      if (sectionFor(slot.whichType) != Section::DATA) continue;
+      uint bytes = typeSizeBits(slot.whichType) / 8;
+      uint start = slot.offset * bytes;
+      if (start > dataEnd) {
+        members.add(kj::strTree("  ::uint8_t _pad", members.size(), "[", start - dataEnd,
+                                "] = {};\n"));
+      }
+      for (auto field: schema.getFields()) {
+        auto proto = field.getProto();
+        auto slotProto = proto.getSlot();
+        if (slotProto.getType().which() == slot.whichType && slotProto.getOffset() == slot.offset) {
+          auto mask = primitiveDefaultMask(slotProto.getType(), slotProto.getDefaultValue());
+          auto name = propertyNameFor(proto);
+          members.add(kj::strTree(
+              "  ::capnp::altcxx::ValueField<", typeName(slotProto.getType()),
+              mask.size() == 0 ? kj::strTree() : kj::strTree(", ", mask), "> ", name, ";\n"));
+          inits.add(kj::strTree(name, "(_", name, ")"));
+          break;
+        }
+      }
+      dataEnd = start + bytes;
+    }
+    if (dataEnd < dataBytes) {
+      members.add(kj::strTree("  ::uint8_t _pad", members.size(), "[", dataBytes - dataEnd,
+                              "] = {};\n"));
+    }
+
+    // Constructor parameters are in the order fields are declared in the schema.  Floats can't be
+    // encoded at compile time, so structs with them aren't constexpr-constructible.
+    bool anyFloat = false;
+    kj::Vector<kj::StringTree> params;
+    for (auto field: schema.getFields()) {
+      auto type = field.getProto().getSlot().getType();
+      if (sectionFor(type.which()) != Section::DATA) continue;
+      anyFloat = anyFloat || type.isFloat32() || type.isFloat64();
+      params.add(kj::strTree(typeName(type), " _", propertyNameFor(field.getProto())));
+    }
+
+    return ValueText {
+      kj::strTree(
+          "struct ", fullName, "::Value {\n",
+          members.releaseAsArray(),
+          "\n"
+          "  constexpr Value() {}\n"
+          "  ", anyFloat ? "" : "constexpr ", "Value(",
+                kj::StringTree(params.releaseAsArray(), ", "), ")\n"
+          "      : ", kj::StringTree(inits.releaseAsArray(), ", "), " {}\n"
+          "\n"
+          "  bool operator == (const Value& other) const {\n"
+          "    return ::capnp::altcxx::sameValue(*this, other);\n"
+          "  }\n"
+          "  bool operator != (const Value& other) const { return !(*this == other); }\n"
+          "};\n"
+          "static_assert(sizeof(", fullName, "::Value) == ", dataBytes, ",\n"
+          "              \"Value must match the data section.\");\n"
+          "\n"),
+
+      kj::strTree(
+          "  Value toValue() {\n"
+          "    Value _out;\n"
+          "    ::capnp::altcxx::copyDataSection(\n"
+          "        Impl::asReader(Impl::asStruct(this)), &_out, sizeof(Value));\n"
+          "    return _out;\n"
+          "  }\n"
+          "\n"
+          "  template <typename = ::kj::EnableIf<!Impl::CONST>>\n"
+          "  void copyFrom(const Value& _in) {\n"
+          "    ::capnp::altcxx::copyDataSection(&_in, Impl::asStruct(this), sizeof(Value));\n"
+          "  }\n"
+          "\n")
+    };
+  }
+
+  // -----------------------------------------------------------------
+  // $projections -- narrow views of a struct.
+
+  struct ProjectionText {
+    kj::StringTree typeDecls;
+    kj::StringTree typeDefs;
+    kj::StringTree baseDefs;
+    kj::StringTree methods;
+  };
+
+  void addProjectionSlots(StructSchema::Field field, kj::Vector<kj::String>& slots) {
+    // The slots a field occupies, including the discriminants that select it.
+
+    auto proto = field.getProto();
+    kj::Vector<kj::String> fieldSlots;
+
+    if (hasDiscriminantValue(proto)) {
+      auto discrimOffset =
+          field.getContainingStruct().getProto().getStruct().getDiscriminantOffset();
+      fieldSlots.add(kj::str("::capnp::altcxx::DataSlot<", discrimOffset, ", 16>"));
+    }
+
+    if (proto.isGroup()) {
+      for (auto member: schemaLoader.get(proto.getGroup().getTypeId()).asStruct().getFields()) {
+        addProjectionSlots(member, slots);
+      }
+    } else {
+      auto slot = proto.getSlot();
+      auto whichType = slot.getType().which();
+      switch (sectionFor(whichType)) {
+        case Section::NONE:
+          break;
+        case Section::DATA:
+          fieldSlots.add(kj::str("::capnp::altcxx::DataSlot<", slot.getOffset(), ", ",
+                                 typeSizeBits(whichType), ">"));
+          break;
+        case Section::POINTERS:
+          fieldSlots.add(kj::str("::capnp::altcxx::PointerSlot<", slot.getOffset(), ">"));
+          break;
+      }
+    }
+
+    for (auto& fieldSlot: fieldSlots) {
+      bool known = false;
+      for (auto& existing: slots) {
+        if (existing == fieldSlot) known = true;
+      }
+      if (!known) slots.add(kj::mv(fieldSlot));
+    }
+  }
+
+  ProjectionText makeProjectionText(kj::StringPtr fullName, StructSchema schema) {
+    ProjectionText result;
+    auto proto = schema.getProto();
+
+    for (auto annotation: proto.getAnnotations()) {
+      if (annotation.getId() != PROJECTIONS_ANNOTATION_ID) continue;
+
+      for (auto declaration: annotation.getValue().getList().getAs<List<Text>>()) {
+        std::string text(declaration.cStr(), declaration.size());
+        auto where = kj::str(proto.getDisplayName(), ": projection \"", declaration, "\"");
+        auto trim = [](std::string part) {
+          part.erase(0, part.find_first_not_of(" \t"));
+          part.erase(part.find_last_not_of(" \t") + 1);
+          return part;
+        };
+
+        size_t equals = text.find('=');
+        if (equals == std::string::npos) {
+          context.exitError(kj::str(where, ": expected \"<Name> = <field>, <field>, ...\""));
+        }
+        auto name = kj::heapString(trim(text.substr(0, equals)).c_str());
+        auto projectionName = kj::str(fullName, "::", name);
+
+        for (auto nested: proto.getNestedNodes()) {
+          if (nested.getName() == name) {
+            context.exitError(kj::str(where, ": ", name, " is already a nested type"));
+          }
+        }
+
+        kj::Vector<kj::StringTree> unionChecks;
+        kj::Vector<kj::StringTree> properties;
+        kj::Vector<kj::String> slots;
+        bool anyInUnion = false;
+
+        std::istringstream fieldNames(text.substr(equals + 1));
+        std::string fieldName;
+        while (std::getline(fieldNames, fieldName, ',')) {
+          fieldName = trim(fieldName);
+          bool found = false;
+          for (auto field: schema.getFields()) {
+            if (field.getProto().getName() == fieldName.c_str()) {
+              auto fieldText = makeFieldText(field);
+              unionChecks.add(kj::mv(fieldText.unionCheck));
+              properties.add(kj::mv(fieldText.property));
+              addProjectionSlots(field, slots);
+              anyInUnion = anyInUnion || hasDiscriminantValue(field.getProto());
+              found = true;
+            }
+          }
+          if (!found) {
+            context.exitError(kj::str(where, ": no field named \"", fieldName.c_str(), "\""));
+          }
+        }
+
+        unionChecks.add(kj::strTree(
+            "  void projectInto(::capnp::altcxx::Builder<", fullName, "> target) {\n"
+            "    Plan::copy(Impl::asReader(Impl::asStruct(this)),\n"
+            "               ::capnp::altcxx::BuilderImpl::asStruct(&target));\n"
+            "  }\n"
+            "\n"));
+
+        result.typeDecls = kj::strTree(kj::mv(result.typeDecls), "  struct ", name, ";\n");
+
+        result.typeDefs = kj::strTree(kj::mv(result.typeDefs),
+            "struct ", projectionName, " {\n"
+            "  ", name, "() = delete;\n"
+            "\n"
+            "  template <typename Impl>\n"
+            "  class Base;\n"
+            "\n"
+            "  typedef ::capnp::altcxx::Reader<", name, "> Reader;\n"
+            "  typedef ::capnp::altcxx::FieldPlan<",
+            kj::StringTree(KJ_MAP(slot, slots) { return kj::strTree("\n      ", slot); }, ","),
+            "> Plan;\n"
+            "};\n"
+            "\n");
+
+        result.baseDefs = kj::strTree(kj::mv(result.baseDefs),
+            makeBaseDef(projectionName, anyInUnion, proto.getStruct().getDiscriminantOffset(),
+                        kj::strTree(), unionChecks.releaseAsArray(), properties.releaseAsArray(),
+                        fullName));
+
+        result.methods = kj::strTree(kj::mv(result.methods),
+            "  ", name, "::Reader as", name, "() {\n"
+            "    return ", name, "::Reader(Impl::asReader(Impl::asStruct(this)));\n"
+            "  }\n"
+            "\n");
+      }
+    }
+
+    return result;
+  }
+
+  // -----------------------------------------------------------------
+  // $payload -- typed dispatch on AnyPointer fields.
+
+  kj::Maybe<Schema> findNestedType(uint64_t scopeId, kj::StringPtr name) {
+    // Looks up a dotted type name the way the schema compiler would within one file: from the
+    // given scope outwards.
+
+    std::vector<std::string> parts;
+    std::istringstream partStream(name.cStr());
+    std::string piece;
+    while (std::getline(partStream, piece, '.')) {
+      parts.push_back(piece);
+    }
+
+    for (uint64_t id = scopeId; id != 0; id = schemaLoader.get(id).getProto().getScopeId()) {
+      Schema node = schemaLoader.get(id);
+      bool found = true;
+      for (auto& part: parts) {
+        found = false;
+        for (auto nested: node.getProto().getNestedNodes()) {
+          if (nested.getName() == part.c_str()) {
+            node = schemaLoader.get(nested.getId());
+            found = true;
+            break;
+          }
+        }
+        if (!found) break;
+      }
+      if (found) return node;
+    }
+    return nullptr;
+  }
+
+  kj::StringTree makePayloadMethods(StructSchema schema) {
+    kj::StringTree result;
+
+    for (auto field: schema.getFields()) {
+      auto proto = field.getProto();
+      for (auto annotation: proto.getAnnotations()) {
+        if (annotation.getId() != PAYLOAD_ANNOTATION_ID) continue;
+
+        auto declaration = annotation.getValue().getText();
+        std::string text(declaration.cStr(), declaration.size());
+        auto where = kj::str(schema.getProto().getDisplayName(), ".", proto.getName(),
+                             ": payload \"", declaration, "\"");
+        auto trim = [](std::string part) {
+          part.erase(0, part.find_first_not_of(" \t"));
+          part.erase(part.find_last_not_of(" \t") + 1);
+          return part;
+        };
+
+        if (proto.isGroup() || !proto.getSlot().getType().isAnyPointer()) {
+          context.exitError(kj::str(where, ": $payload can only be applied to AnyPointer fields"));
+        }
+
+        size_t colon = text.find(':');
+        if (colon == std::string::npos) {
+          context.exitError(kj::str(where, ": expected \"<tag field>: <Type>, <Type>, ...\""));
+        }
+
+        auto tagName = trim(text.substr(0, colon));
+        kj::Maybe<StructSchema::Field> tag;
+        for (auto sibling: schema.getFields()) {
+          auto siblingProto = sibling.getProto();
+          if (siblingProto.getName() == tagName.c_str() && !siblingProto.isGroup() &&
+              siblingProto.getSlot().getType().isUint64()) {
+            tag = sibling;
+          }
+        }
+        StructSchema::Field tagField;
+        KJ_IF_MAYBE(t, tag) {
+          tagField = *t;
+        } else {
+          context.exitError(kj::str(where, ": no UInt64 field named \"", tagName.c_str(), "\""));
+        }
+        if (hasDiscriminantValue(proto) || hasDiscriminantValue(tagField.getProto())) {
+          context.exitError(kj::str(where, ": payload and tag fields can't be union members"));
+        }
+
+        kj::Vector<kj::StringTree> cases;
+        kj::Vector<kj::StringTree> typeIds;
+        std::set<uint64_t> seen;
+
+        std::istringstream typeNames(text.substr(colon + 1));
+        std::string typeText;
+        while (std::getline(typeNames, typeText, ',')) {
+          typeText = trim(typeText);
+          Schema type;
+          KJ_IF_MAYBE(t, findNestedType(schema.getProto().getId(), typeText.c_str())) {
+            type = *t;
+          } else {
+            context.exitError(kj::str(where, ": no type named \"", typeText.c_str(), "\""));
+          }
+          if (!type.getProto().isStruct() || type.getProto().getStruct().getIsGroup()) {
+            context.exitError(kj::str(where, ": \"", typeText.c_str(), "\" is not a struct"));
+          }
+          auto id = type.getProto().getId();
+          if (!seen.insert(id).second) {
+            context.exitError(kj::str(where, ": \"", typeText.c_str(), "\" is listed twice"));
+          }
+
+          auto cppName = cppFullName(type).flatten();
+          cases.add(kj::strTree(
+              "      case 0x", kj::hex(id), "ull:\n"
+              "        return func(", propertyNameFor(proto), ".template getAs<", cppName,
+                                     ">());\n"));
+          typeIds.add(kj::strTree(
+              "  static constexpr uint64_t _", proto.getName(), "TypeId(", cppName, "*) {"
+              " return 0x", kj::hex(id), "ull; }\n"));
+        }
+
+        auto titleCase = toTitleCase(proto.getName());
+        auto payloadProperty = propertyNameFor(proto);
+        result = kj::strTree(kj::mv(result),
+            "  template <typename Func>\n"
+            "  auto visit", titleCase, "(Func&& func)\n"
+            "      -> decltype(func(::kj::instance<typename Impl::template TypeFor<"
+                                   "::capnp::AnyPointer>>())) {\n"
+            "    switch (", propertyNameFor(tagField.getProto()), ".get()) {\n",
+            cases.releaseAsArray(),
+            "      default:\n"
+            "        return func(", payloadProperty, ".get());\n"
+            "    }\n"
+            "  }\n"
+            "\n"
+            "  template <typename T, typename = ::kj::EnableIf<!Impl::CONST>>\n"
+            "  ::capnp::BuilderFor<T> init", titleCase, "As() {\n"
+            "    ", propertyNameFor(tagField.getProto()), " = _", proto.getName(),
+                   "TypeId(static_cast<T*>(nullptr));\n"
+            "    return ", payloadProperty, ".template initAs<T>();\n"
+            "  }\n"
+            "\n",
+            typeIds.releaseAsArray(),
+            "\n");
+      }
+    }
+
+    return result;
+  }
+
+  kj::StringTree makeVisitCall(StructSchema::Field field) {
+    // _visit() tells a visitor about each pointer field and group, so that generic code (e.g.
+    // delta encoding) can walk messages without reflection.  Data fields are left out, as such
+    // code handles the data section as a whole.
+
+    auto proto = field.getProto();
+    auto discrimOffset = field.getContainingStruct().getProto().getStruct().getDiscriminantOffset();
+    auto unionArgs = kj::str(discrimOffset, ", ", proto.getDiscriminantValue());
+
+    if (proto.isGroup()) {
+      auto groupName = toTitleCase(proto.getName());
+      return hasDiscriminantValue(proto)
+          ? kj::strTree("  visitor.template unionGroup<", groupName, ">(", unionArgs, ");\n")
+          : kj::strTree("  visitor.template group<", groupName, ">();\n");
+    }
+
+    auto slot = proto.getSlot();
+    if (sectionFor(slot.getType().which()) != Section::POINTERS) {
+      return kj::strTree();
+    }
+
+    return hasDiscriminantValue(proto)
+        ? kj::strTree("  visitor.template unionField<", typeName(slot.getType()), ">(",
+                      slot.getOffset(), ", ", unionArgs, ");\n")
+        : kj::strTree("  visitor.template field<", typeName(slot.getType()), ">(",
+                      slot.getOffset(), ");\n");
+  }
+
+  kj::StringTree makeWriteCall(StructSchema::Field field) {
+    // _write() hands every field to a TextWriter with its name and where to find it, union
+    // members only when they're set, so messages can be printed without reflection.
+
+    auto proto = field.getProto();
+    kj::StringPtr name = proto.getName();
+    kj::StringTree call;
+
+    if (proto.isGroup()) {
+      call = kj::strTree("writer.template group<", toTitleCase(name), ">(\"", name,
+                         "\", reader);\n");
+    } else {
+      auto slot = proto.getSlot();
+      auto type = slot.getType();
+      switch (sectionFor(type.which())) {
+        case Section::NONE:
+          call = kj::strTree("writer.voidField(\"", name, "\");\n");
+          break;
+        case Section::DATA: {
+          auto mask = primitiveDefaultMask(type, slot.getDefaultValue());
+          if (mask.size() == 0) mask = kj::str("0");
+          call = kj::strTree("writer.template data<", typeName(type), ">(\"", name, "\", reader, ",
+                             slot.getOffset(), ", ", mask, ");\n");
+          break;
+        }
+        case Section::POINTERS:
+          call = kj::strTree("writer.template pointer<", typeName(type), ">(\"", name,
+                             "\", reader, ", slot.getOffset(), ");\n");
+          break;
+      }
+    }
+
+    if (hasDiscriminantValue(proto)) {
+      auto discrimOffset =
+          field.getContainingStruct().getProto().getStruct().getDiscriminantOffset();
+      return kj::strTree(
+          "  if (reader.getDataField<uint16_t>(", discrimOffset, " * ::capnp::ELEMENTS) == ",
+                proto.getDiscriminantValue(), ") {\n"
+          "    ", kj::mv(call),
+          "  }\n");
+    }
+    return kj::strTree("  ", kj::mv(call));
+  }
+
   // -----------------------------------------------------------------
 
   struct StructText {
     kj::StringTree outerTypeDecl;
     kj::StringTree outerTypeDef;
     kj::StringTree readerBuilderDefs;
+    kj::StringTree nativeDef;
   };
 
   kj::StringTree makeBaseDef(kj::StringPtr fullName, bool isUnion, uint discrimOffset,
                              kj::StringTree&& groupInit, kj::Array<kj::StringTree>&& methods,
-                             kj::Array<kj::StringTree>&& properties) {
+                             kj::Array<kj::StringTree>&& properties,
+                             kj::StringPtr schemaName = nullptr) {
+    // `schemaName` is the struct whose schema is used for stringification, if not `fullName`.
     return kj::strTree(
         "template <typename Impl>\n"
         "class ", fullName, "::Base {\n"
@@ -799,8 +1634,10 @@ private:
         "  ::capnp::_::StructReader _reader() const { return _impl.asReader(); }\n"
         "\n",
         kj::mv(groupInit),
-        "  friend ::kj::StringTree KJ_STRINGIFY(Base base) {\n"
-        "    return ::capnp::_::structString<", fullName, ">(base._reader());\n"
+        "  friend ::kj::String KJ_STRINGIFY(Base base) {\n"
+        "    return ::capnp::altcxx::TextWriter().writeStruct<",
+                     schemaName.size() == 0 ? fullName : schemaName, ">(base._reader())\n"
+        "        .finish();\n"
         "  }\n"
         "};\n"
         "\n");
@@ -834,6 +1671,29 @@ private:
     auto fullName = kj::str(scope, name);
     bool noPipeline = !needsPipeline(schema);
     auto fieldTexts = KJ_MAP(f, schema.getFields()) { return makeFieldText(f); };
+    bool mirrored = isMirrored(schema);
+
+    MirrorText mirror;
+    if (mirrored) {
+      mirror = makeMirrorText(fullName, schema);
+    }
+
+    bool hasValue = hasValueType(schema);
+    ValueText value;
+    if (hasValue) {
+      value = makeValueText(fullName, schema);
+    }
+
+    ProjectionText projections = makeProjectionText(fullName, schema);
+
+    auto methods = kj::heapArrayBuilder<kj::StringTree>(fieldTexts.size() + 4);
+    for (auto& f: fieldTexts) {
+      methods.add(kj::mv(f.unionCheck));
+    }
+    methods.add(kj::mv(mirror.methods));
+    methods.add(kj::mv(value.methods));
+    methods.add(kj::mv(projections.methods));
+    methods.add(makePayloadMethods(schema));
 
     auto structNode = proto.getStruct();
     uint discrimOffset = structNode.getDiscriminantOffset();
@@ -876,6 +1736,11 @@ private:
           "  typedef ::capnp::altcxx::Reader<", name, "> Reader;\n"
           "  typedef ::capnp::altcxx::Builder<", name, "> Builder;\n"
           "  typedef ::capnp::altcxx::Pipeline<", name, "> Pipeline;\n"
+          "\n"
+          "  template <typename Visitor>\n"
+          "  static void _visit(Visitor& visitor);\n"
+          "  template <typename Writer>\n"
+          "  static void _write(Writer& writer, const ::capnp::_::StructReader& reader);\n"
           "\n",
           structNode.getDiscriminantCount() == 0 ? kj::strTree() : kj::strTree(
               "  enum Which: uint16_t {\n",
@@ -887,17 +1752,34 @@ private:
                 }
               },
               "  };\n"),
+          mirrored ? kj::strTree("  struct Native;\n") : kj::strTree(),
+          hasValue ? kj::strTree("  struct Value;\n") : kj::strTree(),
+          kj::mv(projections.typeDecls),
           KJ_MAP(n, nestedTypeDecls) { return kj::mv(n); },
           "};\n"
-          "\n"),
+          "\n",
+          kj::mv(projections.typeDefs)),
 
       kj::strTree(
           makeBaseDef(fullName, structNode.getDiscriminantCount() != 0,
                       discrimOffset, kj::mv(groupInit),
-                      KJ_MAP(f, fieldTexts) { return kj::mv(f.unionCheck); },
+                      methods.finish(),
                       KJ_MAP(f, fieldTexts) { return kj::mv(f.property); }),
           noPipeline ? kj::strTree() : makePipelineDef(fullName, name,
-              KJ_MAP(f, fieldTexts) { return kj::mv(f.pipelineProperty); }))
+              KJ_MAP(f, fieldTexts) { return kj::mv(f.pipelineProperty); }),
+          kj::mv(projections.baseDefs),
+          "template <typename Visitor>\n"
+          "void ", fullName, "::_visit(Visitor& visitor) {\n",
+          KJ_MAP(f, schema.getFields()) { return makeVisitCall(f); },
+          "}\n"
+          "\n"
+          "template <typename Writer>\n"
+          "void ", fullName, "::_write(Writer& writer, const ::capnp::_::StructReader& reader) {\n",
+          KJ_MAP(f, schema.getFields()) { return makeWriteCall(f); },
+          "}\n"
+          "\n"),
+
+      kj::strTree(kj::mv(mirror.nativeDef), kj::mv(value.valueDef))
     };
   }
 
@@ -908,9 +1790,11 @@ private:
     kj::StringTree serverDecls;
     kj::StringTree sourceDefs;
     kj::StringTree dispatchCase;
+    bool cacheable;
   };
 
-  MethodText makeMethodText(kj::StringPtr interfaceName, InterfaceSchema::Method method) {
+  MethodText makeMethodText(kj::StringPtr interfaceName, InterfaceSchema::Method method,
+                            bool instrumented) {
     auto proto = method.getProto();
     auto name = proto.getName();
     auto titleCase = toTitleCase(name);
@@ -935,12 +1819,40 @@ private:
     auto interfaceIdHex = kj::hex(interfaceId);
     uint16_t methodId = method.getIndex();
 
+    auto call = kj::strTree(
+        name, "(::capnp::Capability::Server::internalGetTypedContext<\n"
+        "          ", paramType, ", ", resultType, ">(context))");
+    kj::StringTree cachedCall;
+    bool cacheable = false;
+    for (auto annotation: proto.getAnnotations()) {
+      if (annotation.getId() == CACHEABLE_ANNOTATION_ID) {
+        cacheable = true;
+        hasCacheableMethods = true;
+        cachedCall = kj::strTree(
+            "  ::kj::Promise< ::capnp::Response<", resultType, ">> ", name, "Cached(\n"
+            "      ::capnp::Request<", paramType, ", ", resultType, ">&& request) {\n"
+            "    return ::capnp::altcxx::ResultCache::forThread().call(\n"
+            "        *this->hook, 0x", interfaceIdHex, "ull, ", methodId, ", ::kj::mv(request), ",
+                annotation.getValue().getUint32(), ");\n"
+            "  }\n");
+      }
+      if (annotation.getId() == EXECUTOR_ANNOTATION_ID) {
+        hasExecutorMethods = true;
+        call = kj::strTree(
+            "::capnp::altcxx::ThreadPoolExecutor::dispatch(\n"
+            "          \"", annotation.getValue().getText(), "\", context, [this, context]() mutable {\n"
+            "        return ", kj::mv(call), ";\n"
+            "      })");
+      }
+    }
+
     return MethodText {
       kj::strTree(
           "  ::capnp::Request<", paramType, ", ", resultType, "> ", name, "Request("
           "::kj::Maybe< ::capnp::MessageSize> sizeHint = nullptr) { "
           "return this->template newCall<", paramType, ", ", resultType, ">(0x",
-          interfaceIdHex, "ull, ", methodId, ", sizeHint); }\n"),
+          interfaceIdHex, "ull, ", methodId, ", sizeHint); }\n",
+          kj::mv(cachedCall)),
 
       kj::strTree(
           paramProto.getScopeId() != 0 ? kj::strTree() : kj::strTree(
@@ -958,10 +1870,18 @@ private:
           "      0x", interfaceIdHex, "ull, ", methodId, ");\n"
           "}\n"),
 
-      kj::strTree(
+      instrumented ? kj::strTree(
+          "    case ", methodId, ": {\n"
+          "      static ::capnp::altcxx::MethodStats stats(0x", interfaceIdHex, "ull, ", methodId,
+                ", \"", interfaceProto.getDisplayName(), ".", name, "\");\n"
+          "      return stats.track([&]() {\n"
+          "        return ", kj::mv(call), ";\n"
+          "      });\n"
+          "    }\n") : kj::strTree(
           "    case ", methodId, ":\n"
-          "      return ", name, "(::capnp::Capability::Server::internalGetTypedContext<\n"
-          "          ", paramType, ", ", resultType, ">(context));\n")
+          "      return ", kj::mv(call), ";\n"),
+
+      cacheable
     };
   }
 
@@ -981,9 +1901,23 @@ private:
   InterfaceText makeInterfaceText(kj::StringPtr scope, kj::StringPtr name, InterfaceSchema schema,
                                   kj::Array<kj::StringTree> nestedTypeDecls) {
     auto fullName = kj::str(scope, name);
-    auto methods = KJ_MAP(m, schema.getMethods()) { return makeMethodText(fullName, m); };
-
     auto proto = schema.getProto();
+    bool instrumented = false;
+    for (auto annotation: proto.getAnnotations()) {
+      if (annotation.getId() == INSTRUMENT_ANNOTATION_ID) {
+        instrumented = true;
+        hasInstrumentedInterfaces = true;
+      }
+    }
+
+    auto methods = KJ_MAP(m, schema.getMethods()) {
+      return makeMethodText(fullName, m, instrumented);
+    };
+    bool hasCacheable = false;
+    for (auto& method: methods) {
+      hasCacheable = hasCacheable || method.cacheable;
+    }
+
     auto rawExtends = proto.getInterface().getExtends();
     kj::Vector<std::pair<uint64_t, Schema>> allExtends(rawExtends.size() * 2);
 
@@ -1041,6 +1975,11 @@ private:
           "  ClientBase(T&& val) : Base(::kj::fwd<T>(val)) {}\n"
           "\n",
           KJ_MAP(m, methods) { return kj::mv(m.clientDecls); },
+          hasCacheable ? kj::strTree(
+              "\n"
+              "  void invalidateCachedResults() {\n"
+              "    ::capnp::altcxx::ResultCache::forThread().invalidate(*this->hook);\n"
+              "  }\n") : kj::strTree(),
           "\n"
           "protected:\n"
           "  ClientBase() = default;\n"
@@ -1204,6 +2143,7 @@ private:
     kj::StringTree capnpPrivateDecls;
     kj::StringTree capnpPrivateDefs;
     kj::StringTree sourceFileDefs;
+    kj::StringTree nativeDefs;
   };
 
   struct NodeTextNoSchema {
@@ -1215,6 +2155,7 @@ private:
     kj::StringTree capnpPrivateDecls;
     kj::StringTree capnpPrivateDefs;
     kj::StringTree sourceFileDefs;
+    kj::StringTree nativeDefs;
   };
 
   NodeText makeNodeText(kj::StringPtr namespace_, kj::StringPtr scope,
@@ -1372,6 +2313,11 @@ private:
       kj::strTree(
           kj::mv(top.sourceFileDefs),
           KJ_MAP(n, nestedTexts) { return kj::mv(n.sourceFileDefs); }),
+
+      // Nested first, so that mirrors of groups are complete before their parent's.
+      kj::strTree(
+          KJ_MAP(n, nestedTexts) { return kj::mv(n.nativeDefs); },
+          kj::mv(top.nativeDefs)),
     };
   }
 
@@ -1410,6 +2356,7 @@ private:
               "    ", namespace_, "::", fullName, ");\n"),
 
           kj::strTree(),
+          kj::mv(structText.nativeDef),
         };
       }
 
@@ -1433,7 +2380,19 @@ private:
               "};\n"
               "\n"),
 
-          kj::strTree(),
+          enumerants.size() == 0 ? kj::strTree(
+              "inline ::kj::StringPtr _enumName(", fullName, ") { return nullptr; }\n"
+              "\n") : kj::strTree(
+              "inline ::kj::StringPtr _enumName(", fullName, " value) {\n"
+              "  static constexpr const char* NAMES[] = {\n",
+              KJ_MAP(e, enumerants) {
+                return kj::strTree("    \"", e.getProto().getName(), "\",\n");
+              },
+              "  };\n"
+              "  return static_cast<uint16_t>(value) < ", enumerants.size(), " ?\n"
+              "      ::kj::StringPtr(NAMES[static_cast<uint16_t>(value)]) : nullptr;\n"
+              "}\n"
+              "\n"),
           kj::strTree(),
           kj::strTree(),
 
@@ -1575,6 +2534,8 @@ private:
           "\n"
           "#include <capnp/altc++/generated-header-support.h>\n",
           hasInterfaces ? kj::strTree("#include <capnp/altc++/property-rpc.h>\n") : kj::strTree(),
+          hasCacheableMethods ?
+              kj::strTree("#include <capnp/altc++/result-cache.h>\n") : kj::strTree(),
           "\n"
           "#if CAPNP_VERSION != ", CAPNP_VERSION, "\n"
           "#error \"Version mismatch between generated code and library headers.  You must "
@@ -1592,6 +2553,7 @@ private:
 
           KJ_MAP(n, namespaceParts) { return kj::strTree("namespace ", n, " {\n"); }, "\n",
           KJ_MAP(n, nodeTexts) { return kj::mv(n.outerTypeDef); },
+          KJ_MAP(n, nodeTexts) { return kj::mv(n.nativeDefs); },
           KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n",
 
           separator, "\n"
@@ -1622,7 +2584,11 @@ private:
           "// Generated by Cap'n Proto compiler, DO NOT EDIT\n"
           "// source: ", baseName(displayName), "\n"
           "\n"
-          "#include \"", baseName(displayName), ".h\"\n"
+          "#include \"", baseName(displayName), ".h\"\n",
+          hasInstrumentedInterfaces ?
+              kj::strTree("#include <capnp/altc++/instrument.h>\n") : kj::strTree(),
+          hasExecutorMethods ?
+              kj::strTree("#include <capnp/altc++/executor.h>\n") : kj::strTree(),
           "\n"
           "namespace capnp {\n"
           "namespace schemas {\n",
@@ -1640,6 +2606,304 @@ private:
     };
   }
 
+  // -----------------------------------------------------------------
+  // Layout advisor -- given per-field access counts, reports which words and cache lines the hot
+  // fields of a struct occupy, and proposes a layout that keeps them together.
+
+  typedef std::map<std::string, std::map<std::string, uint64_t>> AccessProfile;
+
+  AccessProfile readAccessProfile(kj::StringPtr path) {
+    std::ifstream in(path.cStr());
+    if (!in) {
+      context.exitError(kj::str(path, ": can't open access profile"));
+    }
+
+    AccessProfile profile;
+    std::string line;
+    uint lineNumber = 0;
+
+    while (std::getline(in, line)) {
+      ++lineNumber;
+      auto commentPos = line.find('#');
+      if (commentPos != std::string::npos) line.erase(commentPos);
+
+      std::istringstream columns(line);
+      std::string structName, fieldPath;
+      uint64_t count;
+
+      if (!(columns >> structName)) continue;
+      if (!(columns >> fieldPath >> count)) {
+        context.exitError(kj::str(path, ":", lineNumber,
+                                  ": expected \"<struct> <field> <count>\""));
+      }
+
+      profile[structName][fieldPath] += count;
+    }
+
+    return profile;
+  }
+
+  kj::StringPtr scopedName(Schema schema) {
+    kj::StringPtr displayName = schema.getProto().getDisplayName();
+    KJ_IF_MAYBE(colonPos, displayName.findFirst(':')) {
+      return displayName.slice(*colonPos + 1);
+    } else {
+      return displayName;
+    }
+  }
+
+  kj::String schemaTypeName(schema::Type::Reader type) {
+    switch (type.which()) {
+      case schema::Type::VOID: return kj::str("Void");
+      case schema::Type::BOOL: return kj::str("Bool");
+      case schema::Type::INT8: return kj::str("Int8");
+      case schema::Type::INT16: return kj::str("Int16");
+      case schema::Type::INT32: return kj::str("Int32");
+      case schema::Type::INT64: return kj::str("Int64");
+      case schema::Type::UINT8: return kj::str("UInt8");
+      case schema::Type::UINT16: return kj::str("UInt16");
+      case schema::Type::UINT32: return kj::str("UInt32");
+      case schema::Type::UINT64: return kj::str("UInt64");
+      case schema::Type::FLOAT32: return kj::str("Float32");
+      case schema::Type::FLOAT64: return kj::str("Float64");
+      case schema::Type::TEXT: return kj::str("Text");
+      case schema::Type::DATA: return kj::str("Data");
+      case schema::Type::LIST:
+        return kj::str("List(", schemaTypeName(type.getList().getElementType()), ")");
+      case schema::Type::ENUM:
+        return kj::heapString(scopedName(schemaLoader.get(type.getEnum().getTypeId())));
+      case schema::Type::STRUCT:
+        return kj::heapString(scopedName(schemaLoader.get(type.getStruct().getTypeId())));
+      case schema::Type::INTERFACE:
+        return kj::heapString(scopedName(schemaLoader.get(type.getInterface().getTypeId())));
+      case schema::Type::ANY_POINTER: return kj::str("AnyPointer");
+    }
+    KJ_UNREACHABLE;
+  }
+
+  struct ProfiledField {
+    kj::String path;
+    kj::String type;
+    Section section;
+    uint bitOffset;      // data fields only: offset from the start of the data section.
+    uint bits;           // data fields only.
+    uint pointer;        // pointer fields only: index within the pointer section.
+    uint64_t unionId;    // id of the struct or group owning the union this field is in, or 0.
+    bool discriminant;
+    uint64_t count;
+    bool hot;
+  };
+
+  void collectProfiledFields(StructSchema schema, kj::StringPtr prefix, uint64_t parentUnionId,
+                             kj::Vector<ProfiledField>& fields) {
+    auto proto = schema.getProto();
+    auto structProto = proto.getStruct();
+
+    if (structProto.getDiscriminantCount() > 0) {
+      fields.add(ProfiledField {
+        kj::str(prefix, "(discriminant)"), kj::str("UInt16"), Section::DATA,
+        structProto.getDiscriminantOffset() * 16, 16, 0, proto.getId(), true, 0, false
+      });
+    }
+
+    for (auto field: schema.getFields()) {
+      auto fieldProto = field.getProto();
+      auto path = kj::str(prefix, fieldProto.getName());
+      uint64_t unionId = hasDiscriminantValue(fieldProto) ? proto.getId() : parentUnionId;
+
+      switch (fieldProto.which()) {
+        case schema::Field::SLOT: {
+          auto slot = fieldProto.getSlot();
+          auto whichType = slot.getType().which();
+          auto section = sectionFor(whichType);
+          uint bits = section == Section::DATA ? typeSizeBits(whichType) : 0;
+
+          fields.add(ProfiledField {
+            kj::mv(path), schemaTypeName(slot.getType()), section,
+            slot.getOffset() * bits, bits,
+            section == Section::POINTERS ? slot.getOffset() : 0,
+            unionId, false, 0, false
+          });
+          break;
+        }
+
+        case schema::Field::GROUP:
+          collectProfiledFields(schema.getDependency(fieldProto.getGroup().getTypeId()).asStruct(),
+                                kj::str(path, "."), unionId, fields);
+          break;
+      }
+    }
+  }
+
+  kj::String fieldLocation(const ProfiledField& field, uint dataWords) {
+    switch (field.section) {
+      case Section::NONE:
+        return kj::str("no storage");
+      case Section::DATA: {
+        uint word = field.bitOffset / 64;
+        return kj::str("data word ", word, ", bits ", field.bitOffset % 64, "..",
+                       field.bitOffset % 64 + field.bits - 1, ", line ", word / CACHE_LINE_WORDS);
+      }
+      case Section::POINTERS: {
+        uint word = dataWords + field.pointer;
+        return kj::str("pointer ", field.pointer, " (word ", word, "), line ",
+                       word / CACHE_LINE_WORDS);
+      }
+    }
+    KJ_UNREACHABLE;
+  }
+
+  kj::StringTree makeLayoutReport(StructSchema schema,
+                                  const std::map<std::string, uint64_t>& counts) {
+    auto proto = schema.getProto();
+    auto structProto = proto.getStruct();
+    kj::StringPtr name = scopedName(schema);
+    uint dataWords = structProto.getDataWordCount();
+
+    kj::Vector<ProfiledField> fields;
+    collectProfiledFields(schema, "", 0, fields);
+
+    uint64_t total = 0;
+    for (auto& entry: counts) {
+      auto pred = [&](const ProfiledField& field) {
+        return !field.discriminant && entry.first == field.path.cStr();
+      };
+      auto iter = std::find_if(fields.begin(), fields.end(), pred);
+      if (iter == fields.end()) {
+        context.warning(kj::str(name, ": profile names unknown field \"", entry.first, "\""));
+      } else {
+        iter->count += entry.second;
+        total += entry.second;
+      }
+    }
+
+    if (total == 0) {
+      return kj::strTree("struct ", name, ": no accesses recorded\n\n");
+    }
+
+    // Hot fields are the most accessed ones which together account for HOT_ACCESS_PERCENT of all
+    // accesses.  A union can only move as a whole, so one hot member makes the whole union hot.
+    kj::Vector<ProfiledField*> byCount(fields.size());
+    for (auto& field: fields) byCount.add(&field);
+    std::stable_sort(byCount.begin(), byCount.end(),
+        [](const ProfiledField* a, const ProfiledField* b) { return a->count > b->count; });
+
+    uint64_t covered = 0;
+    for (auto field: byCount) {
+      if (field->count == 0 || covered * 100 >= total * HOT_ACCESS_PERCENT) break;
+      field->hot = true;
+      covered += field->count;
+    }
+
+    std::set<uint64_t> hotUnions;
+    for (auto& field: fields) {
+      if (field.hot && field.unionId != 0) hotUnions.insert(field.unionId);
+    }
+    for (auto& field: fields) {
+      if (hotUnions.count(field.unionId) > 0) field.hot = true;
+    }
+
+    // Current layout.
+    std::set<uint> hotWords;
+    for (auto& field: fields) {
+      if (!field.hot) continue;
+      switch (field.section) {
+        case Section::NONE: break;
+        case Section::DATA: hotWords.insert(field.bitOffset / 64); break;
+        case Section::POINTERS: hotWords.insert(dataWords + field.pointer); break;
+      }
+    }
+    std::set<uint> hotLines;
+    for (uint word: hotWords) hotLines.insert(word / CACHE_LINE_WORDS);
+
+    // Proposed layout.  Field sizes are powers of two, so hot data fields allocated largest first
+    // leave no holes, and cold fields move behind a single pointer.
+    kj::Vector<ProfiledField*> hotData, hotPointers, cold;
+    uint hotDataBits = 0;
+    for (auto& field: fields) {
+      if (field.discriminant) continue;
+      if (!field.hot) {
+        if (field.section != Section::NONE) cold.add(&field);
+      } else if (field.section == Section::POINTERS) {
+        hotPointers.add(&field);
+      } else {
+        hotData.add(&field);
+        hotDataBits += field.bits;
+      }
+    }
+    std::stable_sort(hotData.begin(), hotData.end(),
+        [](const ProfiledField* a, const ProfiledField* b) { return a->bits > b->bits; });
+
+    uint proposedWords = (hotDataBits + 63) / 64 + hotPointers.size() + (cold.size() > 0 ? 1 : 0);
+    uint proposedLines = (proposedWords + CACHE_LINE_WORDS - 1) / CACHE_LINE_WORDS;
+
+    size_t width = 0;
+    for (auto& field: fields) width = kj::max(width, field.path.size());
+
+    auto fieldLine = [&](const ProfiledField& field) {
+      return kj::strTree(
+          "    ", field.hot ? "* " : "  ", field.path, kj::repeat(' ', width - field.path.size()),
+          "  ", field.count, "  ", fieldLocation(field, dataWords), "\n");
+    };
+
+    uint ordinal = 0;
+    auto proposedField = [&](const ProfiledField* field) {
+      return kj::strTree(
+          "    ", field->path, " @", ordinal++, " :", field->type, ";",
+          field->unionId == 0 ? "" : "  # union member, keep with its union", "\n");
+    };
+
+    // Ordinals are handed out as we go, so build each piece in its own statement.
+    auto hotDataText = kj::strTree(KJ_MAP(f, hotData) { return proposedField(f); });
+    auto hotPointersText = kj::strTree(KJ_MAP(f, hotPointers) { return proposedField(f); });
+    auto coldPointerText = cold.size() == 0 ? kj::strTree() :
+        kj::strTree("    cold @", ordinal, " :", name, "Cold;\n");
+    ordinal = 0;
+    auto coldText = kj::strTree(KJ_MAP(f, cold) { return proposedField(f); });
+
+    return kj::strTree(
+        "struct ", name, ": ", dataWords, " data words, ", structProto.getPointerCount(),
+        " pointers, ", total, " accesses\n",
+        KJ_MAP(f, fields) { return f.discriminant && !f.hot ? kj::strTree() : fieldLine(f); },
+        "  current:  hot fields touch ", hotWords.size(), " words in ", hotLines.size(),
+        " cache lines\n"
+        "  proposed: hot fields touch ", proposedWords, " words in ", proposedLines,
+        " cache lines\n",
+        proposedLines >= hotLines.size() ? kj::strTree("  layout is already compact\n") :
+            kj::strTree(
+                "  proposed hot struct ", name, ":\n",
+                kj::mv(hotDataText), kj::mv(hotPointersText), kj::mv(coldPointerText),
+                cold.size() == 0 ? kj::strTree() : kj::strTree(
+                    "  proposed cold struct ", name, "Cold:\n", kj::mv(coldText))),
+        "\n");
+  }
+
+  kj::StringTree makeLayoutReports(schema::CodeGeneratorRequest::Reader request,
+                                   const AccessProfile& profile) {
+    std::set<std::string> matched;
+    kj::Vector<kj::StringTree> reports;
+
+    for (auto node: request.getNodes()) {
+      if (!node.isStruct() || node.getStruct().getIsGroup()) continue;
+
+      auto schema = schemaLoader.get(node.getId()).asStruct();
+      std::string name = scopedName(schema).cStr();
+      auto iter = profile.find(name);
+      if (iter != profile.end()) {
+        matched.insert(name);
+        reports.add(makeLayoutReport(schema, iter->second));
+      }
+    }
+
+    for (auto& entry: profile) {
+      if (matched.count(entry.first) == 0) {
+        context.warning(kj::str("profile names unknown struct \"", entry.first, "\""));
+      }
+    }
+
+    return kj::StringTree(reports.releaseAsArray(), "");
+  }
+
   // -----------------------------------------------------------------
 
   void makeDirectory(kj::StringPtr path) {
@@ -1687,6 +2951,14 @@ private:
     kj::FdOutputStream rawOut(STDOUT_FILENO);
     kj::BufferedOutputStreamWrapper out(rawOut);
 
+    if (accessProfilePath.size() > 0) {
+      makeLayoutReports(request, readAccessProfile(accessProfilePath)).visit(
+          [&](kj::ArrayPtr<const char> text) {
+            out.write(text.begin(), text.size());
+          });
+      return true;
+    }
+
     for (auto requestedFile: request.getRequestedFiles()) {
       auto schema = schemaLoader.get(requestedFile.getId());
       auto fileText = makeFileText(schema, requestedFile);
@@ -0,0 +1,193 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// The workloads of access-bench.c++, written against code generated from test.capnp by the
+// stock C++ plugin.  Keep the two files in sync.
+
+#include <capnp/message.h>
+#include <capnp/rpc-twoparty.h>
+#include <kj/async-io.h>
+#include <test.capnp.h>
+#include "bench.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+namespace test = capnproto_test::capnp::test;
+using test::TestAllTypes;
+
+constexpr uint COUNT = 1000;
+
+void buildFields(TestAllTypes::Builder root) {
+  root.setBoolField(true);
+  root.setInt32Field(123);
+  root.setUInt64Field(456);
+  root.setFloat64Field(1.5);
+  root.setTextField("hello");
+  root.initStructField().setInt32Field(789);
+  auto list = root.initInt32List(4);
+  for (uint i = 0; i < 4; i++) {
+    list.set(i, i);
+  }
+}
+
+int64_t readFields(TestAllTypes::Reader root) {
+  int64_t sum = root.getBoolField() + root.getInt32Field() + root.getUInt64Field() +
+      int64_t(root.getFloat64Field()) + root.getTextField().size() +
+      root.getStructField().getInt32Field();
+  for (int32_t value: root.getInt32List()) {
+    sum += value;
+  }
+  return sum;
+}
+
+class BenchInterface final: public test::TestInterface::Server {
+public:
+  kj::Promise<void> foo(FooContext context) override {
+    context.getResults().setX("foo");
+    return kj::READY_NOW;
+  }
+};
+
+class BenchPipeline final: public test::TestPipeline::Server {
+public:
+  kj::Promise<void> getCap(GetCapContext context) override {
+    auto results = context.getResults();
+    results.setS("bar");
+    results.initOutBox().setCap(kj::heap<BenchInterface>());
+    return kj::READY_NOW;
+  }
+};
+
+class BenchRestorer final: public SturdyRefRestorer<test::TestSturdyRefObjectId> {
+public:
+  Capability::Client restore(test::TestSturdyRefObjectId::Reader objectId) override {
+    return kj::heap<BenchPipeline>();
+  }
+};
+
+void benchAccess() {
+  printf("stock access paths\n");
+
+  static word scratch[1024];
+  runBenchmark("build", COUNT, [&]() {
+    for (uint i = 0; i < COUNT; i++) {
+      MallocMessageBuilder message(kj::arrayPtr(scratch, 1024));
+      buildFields(message.initRoot<TestAllTypes>());
+    }
+  });
+
+  MallocMessageBuilder message;
+  auto root = message.initRoot<TestAllTypes>();
+  buildFields(root);
+  auto reader = root.asReader();
+  runBenchmark("read", COUNT, [&]() {
+    for (uint i = 0; i < COUNT; i++) {
+      doNotOptimize(readFields(reader));
+    }
+  });
+
+  root.initStructField().initStructField().initStructField().setInt32Field(7);
+  runBenchmark("nested access (3 levels)", COUNT, [&]() {
+    for (uint i = 0; i < COUNT; i++) {
+      doNotOptimize(reader.getStructField().getStructField().getStructField().getInt32Field());
+    }
+  });
+
+  auto list = root.initStructList(COUNT);
+  for (uint i = 0; i < COUNT; i++) {
+    list[i].setInt32Field(i);
+  }
+  runBenchmark("list iteration", COUNT, [&]() {
+    int64_t sum = 0;
+    for (TestAllTypes::Reader element: reader.getStructList()) {
+      sum += element.getInt32Field();
+    }
+    doNotOptimize(sum);
+  });
+
+  auto orphan = message.getOrphanage().newOrphan<List<test::TestUnnamedUnion>>(COUNT);
+  auto unions = orphan.get();
+  for (uint i = 0; i < COUNT; i++) {
+    if (i % 3 == 0) {
+      unions[i].setFoo(i);
+    } else {
+      unions[i].setBar(i);
+    }
+  }
+  auto unionReader = orphan.getReader();
+  runBenchmark("union dispatch", COUNT, [&]() {
+    int64_t sum = 0;
+    for (test::TestUnnamedUnion::Reader element: unionReader) {
+      switch (element.which()) {
+        case test::TestUnnamedUnion::FOO: sum += element.getFoo(); break;
+        case test::TestUnnamedUnion::BAR: sum -= element.getBar(); break;
+      }
+    }
+    doNotOptimize(sum);
+  });
+
+  auto ioContext = kj::setupAsyncIo();
+  auto serverThread = ioContext.provider->newPipeThread(
+      [](kj::AsyncIoProvider& ioProvider, kj::AsyncIoStream& stream, kj::WaitScope& waitScope) {
+    TwoPartyVatNetwork network(stream, rpc::twoparty::Side::SERVER);
+    BenchRestorer restorer;
+    auto server = makeRpcServer(network, restorer);
+    network.onDisconnect().wait(waitScope);
+  });
+  TwoPartyVatNetwork network(*serverThread.pipe, rpc::twoparty::Side::CLIENT);
+  auto rpcClient = makeRpcClient(network);
+
+  MallocMessageBuilder hostIdMessage(8);
+  hostIdMessage.initRoot<rpc::twoparty::SturdyRefHostId>().setSide(rpc::twoparty::Side::SERVER);
+  MallocMessageBuilder objectIdMessage(8);
+  objectIdMessage.initRoot<test::TestSturdyRefObjectId>().setTag(
+      test::TestSturdyRefObjectId::Tag::TEST_PIPELINE);
+  auto client = rpcClient.restore(hostIdMessage.getRoot<rpc::twoparty::SturdyRefHostId>(),
+                                  objectIdMessage.getRoot<AnyPointer>())
+      .castAs<test::TestPipeline>();
+
+  runBenchmark("pipelined rpc", 100, [&]() {
+    for (uint i = 0; i < 100; i++) {
+      auto request = client.getCapRequest();
+      request.setN(i);
+      auto promise = request.send();
+      auto fooRequest = promise.getOutBox().getCap().fooRequest();
+      fooRequest.setI(i);
+      doNotOptimize(fooRequest.send().wait(ioContext.waitScope).getX().size());
+    }
+  });
+
+  serverThread.pipe->shutdownWrite();
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
+
+int main() {
+  capnp::_::benchAccess();
+  return 0;
+}
@@ -109,6 +109,45 @@ TEST(Any, AnyPointer) {
   }
 }
 
+struct DescribePayload {
+  kj::String operator()(test::TestEnvelope::Ping::Reader ping) {
+    return kj::str("ping ", uint64_t(ping.sentAt));
+  }
+  kj::String operator()(TestAllTypes::Reader value) {
+    checkTestMessage(value);
+    return kj::str("all types");
+  }
+  kj::String operator()(AnyPointer::Reader) {
+    return kj::str("unknown");
+  }
+};
+
+struct AdvancePing {
+  void operator()(test::TestEnvelope::Ping::Builder ping) { ping.sentAt = ping.sentAt + 1; }
+  void operator()(TestAllTypes::Builder) { ADD_FAILURE(); }
+  void operator()(AnyPointer::Builder) { ADD_FAILURE(); }
+};
+
+TEST(Any, Payload) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestEnvelope>();
+  auto reader = root.asReader();
+
+  EXPECT_EQ("unknown", reader.visitPayload(DescribePayload()));
+
+  root.initPayloadAs<test::TestEnvelope::Ping>().sentAt = 123;
+  EXPECT_NE(0u, uint64_t(root.payloadType));
+  EXPECT_EQ("ping 123", reader.visitPayload(DescribePayload()));
+  root.visitPayload(AdvancePing());
+  EXPECT_EQ("ping 124", reader.visitPayload(DescribePayload()));
+
+  initTestMessage(root.initPayloadAs<TestAllTypes>());
+  EXPECT_EQ("all types", reader.visitPayload(DescribePayload()));
+
+  root.payloadType = 1;
+  EXPECT_EQ("unknown", reader.visitPayload(DescribePayload()));
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
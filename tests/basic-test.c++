@@ -24,6 +24,8 @@
 
 #include <capnp/message.h>
 #include <gtest/gtest.h>
+#include <string>
+#include <vector>
 #include "test-util.h"
 
 namespace capnp {
@@ -192,6 +194,162 @@ TEST(Basic, Orphan) {
   checkTestMessage(root.asReader().structField);
 }
 
+TEST(Basic, ColdFields) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestColdFields>();
+
+  root.hot = 123;
+  EXPECT_EQ_CAST(0u, root.asReader().rarelyUsed);
+  EXPECT_EQ("none", root.asReader().note.get());
+  EXPECT_TRUE(root.cold == nullptr);
+
+  root.rarelyUsed = 456;
+  root.note = "foo";
+  EXPECT_TRUE(root.cold != nullptr);
+  EXPECT_EQ_CAST(123u, root.hot);
+  EXPECT_EQ_CAST(456u, root.asReader().rarelyUsed);
+  EXPECT_EQ_CAST(456u, root.asReader().cold.rarelyUsed);
+  EXPECT_EQ("foo", root.asReader().note.get());
+}
+
+TEST(Basic, Mirror) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestMirror>();
+
+  root.id = 123;
+  root.flags = 7;
+  root.score = 1.5;
+  root.name = "foo";
+  auto tags = root.tags.init(2);
+  tags.set(0, "bar");
+  tags.set(1, "baz");
+  root.child.init().id = 456;
+  root.children.init(1)[0].name = "qux";
+
+  test::TestMirror::Native native;
+  root.asReader().copyTo(native);
+
+  EXPECT_EQ(123u, native.id);
+  EXPECT_EQ(7u, native.flags);
+  EXPECT_EQ(1.5, native.score);
+  EXPECT_STREQ("foo", native.name.cStr());
+  ASSERT_EQ(2u, native.tags.size());
+  EXPECT_STREQ("baz", native.tags[1].cStr());
+  EXPECT_EQ(0u, native.payload.size());
+  ASSERT_TRUE(native.child.get() != nullptr);
+  EXPECT_EQ(456u, native.child->id);
+  EXPECT_TRUE(native.child->child.get() == nullptr);
+  ASSERT_EQ(1u, native.children.size());
+  EXPECT_STREQ("qux", native.children[0].name.cStr());
+
+  native.id = 321;
+  native.tags[1] = kj::heapString("corge");
+
+  MallocMessageBuilder copy;
+  auto copyRoot = copy.initRoot<test::TestMirror>();
+  copyRoot.copyFrom(native);
+
+  auto reader = copyRoot.asReader();
+  EXPECT_EQ_CAST(321u, reader.id);
+  EXPECT_EQ_CAST(7u, reader.flags);
+  EXPECT_EQ_CAST(1.5, reader.score);
+  EXPECT_EQ("foo", reader.name.get());
+  EXPECT_EQ("corge", reader.tags.get()[1]);
+  EXPECT_TRUE(reader.payload == nullptr);
+  EXPECT_EQ_CAST(456u, reader.child.id);
+  EXPECT_TRUE(reader.child.child == nullptr);
+  EXPECT_EQ("qux", reader.children.get()[0].name.get());
+}
+
+TEST(Basic, MirrorUnion) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestMirrorUnion>();
+
+  root.label = "foo";
+  root.point.x = 2;
+
+  test::TestMirrorUnion::Native native;
+  root.asReader().copyTo(native);
+
+  EXPECT_TRUE(native.enabled);
+  EXPECT_EQ(test::TestMirrorUnion::LABEL, native.which);
+  EXPECT_STREQ("foo", native.label.cStr());
+  EXPECT_EQ(2.0f, native.point.x);
+
+  native.which = test::TestMirrorUnion::COUNT;
+  native.count = 5;
+  native.enabled = false;
+
+  MallocMessageBuilder copy;
+  auto copyRoot = copy.initRoot<test::TestMirrorUnion>();
+  copyRoot.copyFrom(native);
+
+  auto reader = copyRoot.asReader();
+  EXPECT_FALSE(reader.enabled);
+  ASSERT_TRUE(reader.isCount());
+  EXPECT_EQ_CAST(5, reader.count);
+  EXPECT_EQ_CAST(2.0f, reader.point.x);
+}
+
+TEST(Basic, Projection) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestProjection>();
+  root.id = 123;
+  root.name = "foo";
+  root.payload = data("bar");
+  root.large = "baz";
+  root.extra = 456;
+
+  auto summary = root.asReader().asSummary();
+  EXPECT_EQ_CAST(123u, summary.id);
+  EXPECT_EQ("foo", summary.name.get());
+  ASSERT_TRUE(summary.isLarge());
+  EXPECT_EQ("baz", summary.large.get());
+
+  MallocMessageBuilder projected;
+  auto projectedRoot = projected.initRoot<test::TestProjection>();
+  summary.projectInto(projectedRoot);
+
+  auto reader = projectedRoot.asReader();
+  EXPECT_EQ_CAST(123u, reader.id);
+  EXPECT_EQ("foo", reader.name.get());
+  EXPECT_TRUE(reader.payload == nullptr);
+  ASSERT_TRUE(reader.isLarge());
+  EXPECT_EQ("baz", reader.large.get());
+  EXPECT_EQ_CAST(7, reader.extra);
+
+  // Fields null in the source are cleared in the target.
+  MallocMessageBuilder other;
+  auto otherRoot = other.initRoot<test::TestProjection>();
+  otherRoot.small = 5;
+  otherRoot.asReader().asSummary().projectInto(projectedRoot);
+  EXPECT_TRUE(reader.name == nullptr);
+  ASSERT_TRUE(reader.isSmall());
+  EXPECT_EQ_CAST(5u, reader.small);
+}
+
+TEST(Basic, ListFill) {
+  struct Item {
+    uint32_t id;
+    std::string name;
+  };
+  std::vector<Item> items = {{1, "one"}, {2, "two"}, {3, "three"}};
+
+  MallocMessageBuilder builder(altcxx::listSizeHint<TestAllTypes>(items.size(), 11, 3) + 16);
+  auto root = builder.initRoot<TestAllTypes>();
+  auto list = root.structList.fill(items, [](TestAllTypes::Builder element, const Item& item) {
+    element.uInt32Field = item.id;
+    element.textField = item.name.c_str();
+  });
+  EXPECT_EQ(3u, list.size());
+  EXPECT_EQ(1u, builder.getSegmentsForOutput().size());
+
+  auto reader = root.asReader();
+  ASSERT_EQ(3u, reader.structList.size());
+  EXPECT_EQ_CAST(2u, reader.structList[1].uInt32Field);
+  EXPECT_EQ("three", reader.structList[2].textField.get());
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -0,0 +1,101 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/batch.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <capnp/serialize-async.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(Batch, WriteToFd) {
+  int fds[2];
+  KJ_SYSCALL(pipe(fds));
+  kj::AutoCloseFd readEnd(fds[0]), writeEnd(fds[1]);
+
+  MallocMessageBuilder borrowed;
+  initTestMessage(borrowed.initRoot<TestAllTypes>());
+
+  altcxx::MessageBatch batch;
+  batch.add(borrowed);
+  size_t expectedBytes = computeSerializedSizeInWords(borrowed) * sizeof(word);
+  for (int i = 0; i < 10; i++) {
+    // Small first segments make multi-segment messages.
+    auto message = kj::heap<MallocMessageBuilder>(4, AllocationStrategy::FIXED_SIZE);
+    message->initRoot<TestAllTypes>().int32Field = i;
+    message->getRoot<TestAllTypes>().textField = "some text in a segment of its own";
+    expectedBytes += computeSerializedSizeInWords(*message) * sizeof(word);
+    batch.add(kj::mv(message));
+  }
+  EXPECT_EQ(11u, batch.size());
+  EXPECT_EQ(expectedBytes, batch.getByteCount());
+
+  batch.write(writeEnd);
+  EXPECT_EQ(0u, batch.size());
+  EXPECT_EQ(0u, batch.getByteCount());
+  writeEnd = nullptr;
+
+  {
+    StreamFdMessageReader reader(readEnd);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+  for (int i = 0; i < 10; i++) {
+    StreamFdMessageReader reader(readEnd);
+    EXPECT_EQ_CAST(i, reader.getRoot<TestAllTypes>().int32Field);
+    EXPECT_EQ("some text in a segment of its own",
+              reader.getRoot<TestAllTypes>().textField.get());
+  }
+  char extra;
+  EXPECT_EQ(0, read(readEnd, &extra, 1));
+}
+
+TEST(Batch, WriteAsync) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = ioContext.provider->newTwoWayPipe();
+
+  altcxx::MessageBatch batch;
+  for (int i = 0; i < 3; i++) {
+    auto message = kj::heap<MallocMessageBuilder>();
+    message->initRoot<TestAllTypes>().int32Field = i;
+    batch.add(kj::mv(message));
+  }
+
+  auto promise = batch.write(*pipe.ends[0]);
+  EXPECT_EQ(0u, batch.size());
+
+  for (int i = 0; i < 3; i++) {
+    auto reader = readMessage(*pipe.ends[1]).wait(ioContext.waitScope);
+    EXPECT_EQ_CAST(i, reader->getRoot<TestAllTypes>().int32Field);
+  }
+  promise.wait(ioContext.waitScope);
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
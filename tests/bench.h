@@ -0,0 +1,136 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CAPNP_BENCH_H_
+#define CAPNP_BENCH_H_
+
+// Timing helpers shared by the benchmarks, which don't depend on either flavor of generated
+// code so that the same harness measures both.
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <cstdio>
+
+#if __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace capnp {
+namespace _ {  // private
+
+class InstructionCounter {
+  // Counts user space instructions retired by this thread, where the kernel allows it (see
+  // /proc/sys/kernel/perf_event_paranoid).
+
+public:
+  InstructionCounter() {
+#if __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~InstructionCounter() {
+#if __linux__
+    if (fd >= 0) close(fd);
+#endif
+  }
+
+  InstructionCounter(const InstructionCounter&) = delete;
+  InstructionCounter& operator=(const InstructionCounter&) = delete;
+
+  bool isAvailable() const { return fd >= 0; }
+
+  void start() {
+#if __linux__
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  uint64_t stop() {
+    uint64_t count = 0;
+#if __linux__
+    if (fd < 0) return 0;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+    return count;
+  }
+
+private:
+  int fd = -1;
+};
+
+template <typename Func>
+void runBenchmark(const char* name, uint64_t opsPerRun, Func&& func) {
+  // Runs func() for about half a second after a warm-up run, then prints the time and the
+  // instructions per operation, `opsPerRun` being the number of operations func() does.
+
+  func();
+
+  static InstructionCounter counter;
+  uint64_t runs = 0;
+  uint64_t instructions = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed;
+  do {
+    counter.start();
+    func();
+    instructions += counter.stop();
+    runs++;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed.count() < 0.5);
+
+  double ops = double(runs) * opsPerRun;
+  if (counter.isAvailable()) {
+    printf("  %-24s %10.2f ns/op %10.1f instr/op\n", name, elapsed.count() * 1e9 / ops,
+           instructions / ops);
+  } else {
+    printf("  %-24s %10.2f ns/op %16s\n", name, elapsed.count() * 1e9 / ops, "n/a instr/op");
+  }
+}
+
+template <typename T>
+inline void doNotOptimize(const T& value) {
+  // Keeps the compiler from dropping computations whose results are otherwise unused.
+  asm volatile("" : : "g"(value) : "memory");
+}
+
+}  // namespace _ (private)
+}  // namespace capnp
+
+#endif  // CAPNP_BENCH_H_
@@ -0,0 +1,70 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Throughput of the generated canonical writer against copying the same message through capnp's
+// generic copy into a fresh single segment and hashing the flat result, on a message of 100
+// copies of initTestMessage() spread over many small segments.
+
+#include <capnp/altc++/canonical.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include "bench.h"
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+
+void benchCanonical() {
+  MallocMessageBuilder builder(64, AllocationStrategy::FIXED_SIZE);
+  auto list = builder.initRoot<TestAllTypes>().structList.init(100);
+  for (uint i = 0; i < list.size(); i++) {
+    initTestMessage(list[i]);
+  }
+  auto reader = builder.getRoot<TestAllTypes>().asReader();
+  auto anyReader = builder.getRoot<AnyPointer>().asReader();
+
+  size_t canonicalSize = altcxx::canonicalize(reader).size();
+
+  altcxx::CanonicalWriter writer;
+  altcxx::CanonicalWriter hashingWriter(true);
+
+  printf("canonical form, %zu segments, %zu canonical words\n",
+         builder.getSegmentsForOutput().size(), canonicalSize);
+  runBenchmark("copy + hash", 1, [&]() {
+    MallocMessageBuilder copy;
+    copy.getRoot<AnyPointer>().set(anyReader);
+    doNotOptimize(altcxx::canonicalHash(messageToFlatArray(copy)));
+  });
+  runBenchmark("canonicalize", 1, [&]() {
+    doNotOptimize(altcxx::canonicalize(reader).size());
+  });
+  runBenchmark("reused writer", 1, [&]() { doNotOptimize(writer.write(reader).size()); });
+  runBenchmark("reused writer + hash", 1, [&]() {
+    hashingWriter.write(reader);
+    doNotOptimize(hashingWriter.getHash());
+  });
+}
+
+}  // namespace _ (private)
+}  // namespace capnp
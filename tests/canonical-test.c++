@@ -0,0 +1,182 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/canonical.h>
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+bool sameWords(kj::ArrayPtr<const word> a, kj::ArrayPtr<const word> b) {
+  return a.size() == b.size() && memcmp(a.begin(), b.begin(), a.size() * sizeof(word)) == 0;
+}
+
+TEST(Canonical, SegmentLayout) {
+  MallocMessageBuilder single;
+  initTestMessage(single.initRoot<TestAllTypes>());
+  MallocMessageBuilder multi(1, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(multi.initRoot<TestAllTypes>());
+  ASSERT_GT(multi.getSegmentsForOutput().size(), 1u);
+
+  auto singleRoot = single.getRoot<TestAllTypes>().asReader();
+  auto multiRoot = multi.getRoot<TestAllTypes>().asReader();
+  auto canonical = altcxx::canonicalize(singleRoot);
+  EXPECT_TRUE(sameWords(canonical, altcxx::canonicalize(multiRoot)));
+
+  uint64_t hash = altcxx::canonicalHash(singleRoot);
+  EXPECT_EQ(hash, altcxx::canonicalHash(multiRoot));
+  EXPECT_EQ(hash, altcxx::canonicalHash(canonical));
+
+  checkTestMessage(readMessageUnchecked<TestAllTypes>(canonical.begin()));
+  auto again = altcxx::canonicalize(readMessageUnchecked<TestAllTypes>(canonical.begin()));
+  EXPECT_TRUE(sameWords(canonical, again));
+
+  multi.getRoot<TestAllTypes>().structList.get()[1].uInt8Field = 5;
+  EXPECT_NE(hash, altcxx::canonicalHash(multiRoot));
+}
+
+TEST(Canonical, Trimming) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.int8Field = 1;
+  root.structField.init();
+
+  // The root pointer, one data word and the pointers up to structField, which points to an
+  // empty struct.
+  auto canonical = altcxx::canonicalize(root.asReader());
+  EXPECT_EQ(5u, canonical.size());
+  auto read = readMessageUnchecked<TestAllTypes>(canonical.begin());
+  EXPECT_EQ_CAST(1, read.int8Field);
+  EXPECT_FALSE(read.structField == nullptr);
+
+  MallocMessageBuilder zeroed;
+  auto zeroedRoot = zeroed.initRoot<TestAllTypes>();
+  zeroedRoot.int8Field = 1;
+  zeroedRoot.int64Field = 12;
+  zeroedRoot.int64Field = 0;
+  zeroedRoot.structField.init();
+  EXPECT_TRUE(sameWords(canonical, altcxx::canonicalize(zeroedRoot.asReader())));
+}
+
+TEST(Canonical, InactiveUnionMember) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnion>();
+  root.union0.u0f0sp = "foo";
+  root.union0.u0f0s8 = 5;
+
+  MallocMessageBuilder expected;
+  expected.initRoot<TestUnion>().union0.u0f0s8 = 5;
+
+  EXPECT_TRUE(sameWords(altcxx::canonicalize(expected.getRoot<TestUnion>().asReader()),
+                        altcxx::canonicalize(root.asReader())));
+}
+
+TEST(Canonical, StreamingHash) {
+  altcxx::CanonicalWriter writer(true);
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  auto words = writer.write(root.asReader());
+  EXPECT_EQ(altcxx::canonicalHash(words), writer.getHash());
+  uint64_t hash = writer.getHash();
+
+  root.textField = "changed";
+  writer.write(root.asReader());
+  EXPECT_NE(hash, writer.getHash());
+
+  altcxx::CanonicalWriter unhashed;
+  unhashed.write(root.asReader());
+  EXPECT_ANY_THROW(unhashed.getHash());
+}
+
+TEST(Canonical, AnyPointer) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestAnyPointer>();
+  EXPECT_EQ(1u, altcxx::canonicalize(root.asReader()).size());
+
+  root.anyPointerField.setAs<Text>("foo");
+  auto text = altcxx::canonicalize(root.asReader());
+  EXPECT_EQ(3u, text.size());
+  EXPECT_EQ("foo", readMessageUnchecked<test::TestAnyPointer>(text.begin())
+      .anyPointerField.getAs<Text>());
+
+  // Targets are copied without a schema, but still don't depend on the original layout.
+  initTestMessage(root.anyPointerField.initAs<TestAllTypes>());
+  MallocMessageBuilder multi(1, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(multi.initRoot<test::TestAnyPointer>().anyPointerField.initAs<TestAllTypes>());
+  ASSERT_GT(multi.getSegmentsForOutput().size(), 1u);
+
+  auto canonical = altcxx::canonicalize(root.asReader());
+  EXPECT_TRUE(sameWords(canonical,
+      altcxx::canonicalize(multi.getRoot<test::TestAnyPointer>().asReader())));
+  checkTestMessage(readMessageUnchecked<test::TestAnyPointer>(canonical.begin())
+      .anyPointerField.getAs<TestAllTypes>());
+}
+
+TEST(Canonical, InterleavedGroups) {
+  // Targets follow in pointer order, not in the order _visit() declares the fields, so the typed
+  // walk agrees with the untyped one used for AnyPointer fields.
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestInterleavedGroups>();
+  auto corge1 = root.group1.corge.init();
+  corge1.plugh = "plugh1";
+  corge1.xyzzy = "xyzzy1";
+  root.group1.waldo = "waldo1";
+  auto corge2 = root.group2.corge.init();
+  corge2.plugh = "plugh2";
+  corge2.xyzzy = "xyzzy2";
+  root.group2.waldo = "waldo2";
+  auto typed = altcxx::canonicalize(root.asReader());
+
+  MallocMessageBuilder wrapped;
+  wrapped.initRoot<test::TestAnyPointer>().anyPointerField.setAs<test::TestInterleavedGroups>(
+      root.asReader());
+  auto untyped = altcxx::canonicalize(wrapped.getRoot<test::TestAnyPointer>().asReader());
+  ASSERT_EQ(typed.size() + 1, untyped.size());
+  EXPECT_TRUE(sameWords(typed, untyped.slice(1, untyped.size())));
+}
+
+TEST(Canonical, UnknownPointers) {
+  // Pointers past the schema of the reader are kept.
+  MallocMessageBuilder builder(64);
+  auto root = builder.initRoot<test::TestNewVersion>();
+  root.old1 = 123;
+  root.old2 = "foo";
+  root.new2 = "bar";
+  auto segments = builder.getSegmentsForOutput();
+  ASSERT_EQ(1u, segments.size());
+
+  auto old = readMessageUnchecked<test::TestOldVersion>(segments[0].begin());
+  auto canonical = altcxx::canonicalize(old);
+  EXPECT_TRUE(sameWords(canonical, altcxx::canonicalize(root.asReader())));
+  EXPECT_EQ("bar", readMessageUnchecked<test::TestNewVersion>(canonical.begin()).new2.get());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,58 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/compact.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(Compact, Compact) {
+  altcxx::CompactingMessage<TestAllTypes> message;
+  initTestMessage(message.initRoot());
+  size_t live = message.liveWords();
+  EXPECT_FALSE(message.compactIfBloated());
+
+  for (int i = 0; i < 100; i++) {
+    message.getRoot().textField = "a string long enough to take up a few words";
+    message.getRoot().structField.init().int32Field = i;
+  }
+
+  EXPECT_GT(message.allocatedWords(), live * 2);
+  EXPECT_TRUE(message.compactIfBloated());
+  EXPECT_EQ(message.liveWords(), message.allocatedWords());
+  EXPECT_EQ(1u, message.getSegmentsForOutput().size());
+  EXPECT_FALSE(message.compactIfBloated());
+
+  auto root = message.getRoot().asReader();
+  EXPECT_EQ("a string long enough to take up a few words", root.textField.get());
+  EXPECT_EQ_CAST(99, root.structField.int32Field);
+  EXPECT_EQ_CAST(-123, root.int8Field);
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
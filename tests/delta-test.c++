@@ -0,0 +1,125 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/delta.h>
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+template <typename T>
+typename T::Builder copyInto(MallocMessageBuilder& to, MallocMessageBuilder& from) {
+  to.getRoot<AnyPointer>().set(from.getRoot<AnyPointer>().asReader());
+  return to.getRoot<T>();
+}
+
+TEST(Delta, AllTypes) {
+  MallocMessageBuilder oldMessage;
+  auto oldRoot = oldMessage.initRoot<TestAllTypes>();
+  initTestMessage(oldRoot);
+
+  EXPECT_EQ(0u, altcxx::diff(oldRoot.asReader(), oldRoot.asReader()).size());
+
+  MallocMessageBuilder newMessage;
+  auto newRoot = copyInto<TestAllTypes>(newMessage, oldMessage);
+  newRoot.int32Field = 1;
+  newRoot.structField.textField = "changed";
+  newRoot.structList.get()[1].uInt8Field = 5;
+  auto int16List = newRoot.int16List.init(2);
+  int16List.set(0, 1);
+  int16List.set(1, 2);
+
+  auto delta = altcxx::diff(oldRoot.asReader(), newRoot.asReader());
+  EXPECT_LT(delta.size(), newMessage.getSegmentsForOutput()[0].size() / 4);
+
+  MallocMessageBuilder appliedMessage;
+  auto appliedRoot = copyInto<TestAllTypes>(appliedMessage, oldMessage);
+  altcxx::applyDelta(appliedRoot, delta);
+
+  EXPECT_EQ(0u, altcxx::diff(appliedRoot.asReader(), newRoot.asReader()).size());
+  EXPECT_EQ_CAST(1, appliedRoot.int32Field);
+  EXPECT_EQ("changed", appliedRoot.asReader().structField.textField.get());
+  EXPECT_EQ_CAST(5u, appliedRoot.asReader().structList.get()[1].uInt8Field);
+  EXPECT_EQ(2u, appliedRoot.asReader().int16List.get().size());
+}
+
+TEST(Delta, NullFields) {
+  MallocMessageBuilder oldMessage;
+  auto oldRoot = oldMessage.initRoot<TestAllTypes>();
+  oldRoot.textField = "foo";
+
+  MallocMessageBuilder newMessage;
+  auto newRoot = newMessage.initRoot<TestAllTypes>();
+  newRoot.structField.init().int8Field = 12;
+
+  auto delta = altcxx::diff(oldRoot.asReader(), newRoot.asReader());
+  altcxx::applyDelta(oldRoot, delta);
+
+  EXPECT_TRUE(oldRoot.asReader().textField == nullptr);
+  EXPECT_EQ_CAST(12, oldRoot.asReader().structField.int8Field);
+  EXPECT_EQ(0u, altcxx::diff(oldRoot.asReader(), newRoot.asReader()).size());
+}
+
+TEST(Delta, UnionGroups) {
+  MallocMessageBuilder oldMessage;
+  auto oldRoot = oldMessage.initRoot<test::TestGroups>();
+  oldRoot.groups.foo.init().garply = "foobar";
+
+  MallocMessageBuilder newMessage;
+  auto newRoot = newMessage.initRoot<test::TestGroups>();
+  auto baz = newRoot.groups.baz.init();
+  baz.grault = "bazqux";
+  baz.garply = "quxquux";
+
+  auto delta = altcxx::diff(oldRoot.asReader(), newRoot.asReader());
+  altcxx::applyDelta(oldRoot, delta);
+
+  auto groups = oldRoot.asReader().groups.get();
+  ASSERT_EQ(test::TestGroups::Groups::BAZ, groups.which());
+  EXPECT_EQ("bazqux", groups.baz.grault.get());
+  EXPECT_EQ("quxquux", groups.baz.garply.get());
+}
+
+TEST(Delta, AnyPointer) {
+  MallocMessageBuilder oldMessage;
+  auto oldRoot = oldMessage.initRoot<test::TestAnyPointer>();
+  initTestMessage(oldRoot.anyPointerField.initAs<TestAllTypes>());
+
+  MallocMessageBuilder newMessage;
+  auto newRoot = copyInto<test::TestAnyPointer>(newMessage, oldMessage);
+  EXPECT_EQ(0u, altcxx::diff(oldRoot.asReader(), newRoot.asReader()).size());
+
+  newRoot.anyPointerField.setAs<Text>("foo");
+  auto delta = altcxx::diff(oldRoot.asReader(), newRoot.asReader());
+  EXPECT_NE(0u, delta.size());
+  altcxx::applyDelta(oldRoot, delta);
+  EXPECT_EQ("foo", oldRoot.asReader().anyPointerField.getAs<Text>());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
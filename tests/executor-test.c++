@@ -0,0 +1,168 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/executor.h>
+#include <capnp/capability.h>
+#include <capnp/message.h>
+#include <capnp/rpc-twoparty.h>
+#include <kj/async-io.h>
+#include <gtest/gtest.h>
+#include <functional>
+#include <thread>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+uint64_t currentThread() {
+  return std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+class TestExecutorImpl final: public test::TestExecutor::Server {
+public:
+  kj::Promise<void> where(WhereContext context) override {
+    uint32_t n = context.getParams().n;
+    KJ_REQUIRE(n != 0, "n is zero");
+    auto results = context.getResults();
+    results.thread = currentThread();
+    results.n = n;
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> here(HereContext context) override {
+    context.getResults().thread = currentThread();
+    return kj::READY_NOW;
+  }
+};
+
+TEST(Executor, RunsOnPool) {
+  auto ioContext = kj::setupAsyncIo();
+  altcxx::ThreadPoolExecutor executor(*ioContext.lowLevelProvider, "test", 2);
+  test::TestExecutor::Client client = kj::heap<TestExecutorImpl>();
+
+  kj::Vector<kj::Promise<void>> calls;
+  for (uint32_t i = 1; i <= 20; i++) {
+    auto request = client.whereRequest();
+    request.n = i;
+    calls.add(request.send().then([i](Response<test::TestExecutor::WhereResults>&& response) {
+      EXPECT_NE(currentThread(), uint64_t(response.thread));
+      EXPECT_EQ(i, uint32_t(response.n));
+    }));
+  }
+  kj::joinPromises(calls.releaseAsArray()).wait(ioContext.waitScope);
+
+  // Methods without the annotation stay on the loop.
+  auto here = client.hereRequest().send().wait(ioContext.waitScope);
+  EXPECT_EQ(currentThread(), uint64_t(here.thread));
+
+  auto request = client.whereRequest();
+  request.n = 0;
+  EXPECT_ANY_THROW(request.send().wait(ioContext.waitScope));
+}
+
+class ExecutorRestorer final: public SturdyRefRestorer<test::TestSturdyRefObjectId> {
+public:
+  Capability::Client restore(test::TestSturdyRefObjectId::Reader objectId) override {
+    return kj::heap<TestExecutorImpl>();
+  }
+};
+
+TEST(Executor, TwoParty) {
+  // Over RPC the params and results live in connection messages, unlike with local clients.
+  auto ioContext = kj::setupAsyncIo();
+  altcxx::ThreadPoolExecutor executor(*ioContext.lowLevelProvider, "test", 2);
+  uint64_t serverThread = currentThread();
+
+  auto clientThread = ioContext.provider->newPipeThread(
+      [serverThread](kj::AsyncIoProvider& ioProvider, kj::AsyncIoStream& stream,
+                     kj::WaitScope& waitScope) {
+    TwoPartyVatNetwork network(stream, rpc::twoparty::Side::CLIENT);
+    auto rpcClient = makeRpcClient(network);
+
+    MallocMessageBuilder hostIdMessage(8);
+    hostIdMessage.initRoot<rpc::twoparty::SturdyRefHostId>().setSide(
+        rpc::twoparty::Side::SERVER);
+    MallocMessageBuilder objectIdMessage(8);
+    objectIdMessage.initRoot<test::TestSturdyRefObjectId>();
+    auto client = rpcClient.restore(hostIdMessage.getRoot<rpc::twoparty::SturdyRefHostId>(),
+                                    objectIdMessage.getRoot<AnyPointer>())
+        .castAs<test::TestExecutor>();
+
+    kj::Vector<kj::Promise<void>> calls;
+    for (uint32_t i = 1; i <= 20; i++) {
+      auto request = client.whereRequest();
+      request.n = i;
+      calls.add(request.send().then(
+          [i, serverThread](Response<test::TestExecutor::WhereResults>&& response) {
+        EXPECT_NE(serverThread, uint64_t(response.thread));
+        EXPECT_NE(currentThread(), uint64_t(response.thread));
+        EXPECT_EQ(i, uint32_t(response.n));
+      }));
+    }
+    kj::joinPromises(calls.releaseAsArray()).wait(waitScope);
+
+    auto here = client.hereRequest().send().wait(waitScope);
+    EXPECT_EQ(serverThread, uint64_t(here.thread));
+
+    auto request = client.whereRequest();
+    request.n = 0;
+    EXPECT_ANY_THROW(request.send().wait(waitScope));
+  });
+
+  TwoPartyVatNetwork network(*clientThread.pipe, rpc::twoparty::Side::SERVER);
+  ExecutorRestorer restorer;
+  auto server = makeRpcServer(network, restorer);
+  network.onDisconnect().wait(ioContext.waitScope);
+}
+
+TEST(Executor, Cancel) {
+  auto ioContext = kj::setupAsyncIo();
+  altcxx::ThreadPoolExecutor executor(*ioContext.lowLevelProvider, "test", 1);
+  test::TestExecutor::Client client = kj::heap<TestExecutorImpl>();
+
+  for (uint32_t i = 1; i <= 20; i++) {
+    auto request = client.whereRequest();
+    request.n = i;
+    auto promise = request.send();
+  }
+  auto request = client.whereRequest();
+  request.n = 1;
+  request.send().wait(ioContext.waitScope);
+}
+
+TEST(Executor, WithoutPool) {
+  auto ioContext = kj::setupAsyncIo();
+  test::TestExecutor::Client client = kj::heap<TestExecutorImpl>();
+
+  auto request = client.whereRequest();
+  request.n = 7;
+  auto response = request.send().wait(ioContext.waitScope);
+  EXPECT_EQ(currentThread(), uint64_t(response.thread));
+  EXPECT_EQ(7u, uint32_t(response.n));
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,127 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/instrument.h>
+#include <capnp/capability.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+class TestInstrumentedImpl final: public test::TestInstrumented::Server {
+public:
+  explicit TestInstrumentedImpl(int& callCount): callCount(callCount) {}
+
+  kj::Promise<void> foo(FooContext context) override {
+    ++callCount;
+    uint32_t i = context.getParams().i;
+    context.getResults().x = kj::str("foo ", i).cStr();
+    return kj::READY_NOW;
+  }
+
+private:
+  int& callCount;
+};
+
+kj::Maybe<altcxx::MethodStats::Snapshot> findStats(uint16_t methodId) {
+  for (auto& snapshot: altcxx::MethodStats::snapshotAll()) {
+    if (snapshot.interfaceId == typeId<test::TestInstrumented>() &&
+        snapshot.methodId == methodId) {
+      return snapshot;
+    }
+  }
+  return nullptr;
+}
+
+uint64_t callsSoFar(uint16_t methodId) {
+  auto stats = findStats(methodId);
+  KJ_IF_MAYBE(snapshot, stats) {
+    return snapshot->calls;
+  }
+  return 0;
+}
+
+TEST(Instrument, Buckets) {
+  typedef altcxx::MethodStats Stats;
+  for (uint64_t nanos: {0, 1, 2, 3, 4, 5, 6, 7, 8, 1000, 1500, 123456789}) {
+    uint bucket = Stats::bucketFor(nanos);
+    EXPECT_LT(nanos, Stats::bucketLimit(bucket));
+    if (bucket > 0) {
+      EXPECT_GE(nanos, Stats::bucketLimit(bucket - 1));
+    }
+  }
+  EXPECT_EQ(Stats::BUCKET_COUNT - 1, Stats::bucketFor(UINT64_MAX));
+
+  Stats::Snapshot snapshot;
+  snapshot.calls = 101;
+  snapshot.inFlight = 1;
+  for (auto& count: snapshot.latencyCounts) count = 0;
+  snapshot.latencyCounts[Stats::bucketFor(1000)] = 90;
+  snapshot.latencyCounts[Stats::bucketFor(1000000)] = 10;
+  EXPECT_EQ(Stats::bucketLimit(Stats::bucketFor(1000)), snapshot.percentile(0.5));
+  EXPECT_EQ(Stats::bucketLimit(Stats::bucketFor(1000000)), snapshot.percentile(0.95));
+  EXPECT_EQ(Stats::bucketLimit(Stats::bucketFor(1000000)), snapshot.percentile(1.0));
+}
+
+TEST(Instrument, Dispatch) {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  int callCount = 0;
+  test::TestInstrumented::Client client = kj::heap<TestInstrumentedImpl>(callCount);
+  uint64_t fooBefore = callsSoFar(0);
+  uint64_t barBefore = callsSoFar(1);
+
+  for (int i = 0; i < 3; i++) {
+    auto request = client.fooRequest();
+    request.i = 123;
+    EXPECT_EQ("foo 123", request.send().wait(waitScope).x.get());
+  }
+  // Failed calls count too.
+  EXPECT_ANY_THROW(client.barRequest().send().wait(waitScope));
+  EXPECT_EQ(3, callCount);
+
+  auto fooStats = findStats(0);
+  KJ_IF_MAYBE(foo, fooStats) {
+    EXPECT_EQ(fooBefore + 3, foo->calls);
+    EXPECT_EQ(0u, foo->inFlight);
+    EXPECT_LT(0u, foo->percentile(0.5));
+    EXPECT_TRUE(foo->name.endsWith("TestInstrumented.foo"));
+  } else {
+    ADD_FAILURE() << "no stats for TestInstrumented.foo";
+  }
+  auto barStats = findStats(1);
+  KJ_IF_MAYBE(bar, barStats) {
+    EXPECT_EQ(barBefore + 1, bar->calls);
+    EXPECT_EQ(0u, bar->inFlight);
+  } else {
+    ADD_FAILURE() << "no stats for TestInstrumented.bar";
+  }
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,103 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/list-index.h>
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(ListIndex, FieldKey) {
+  MallocMessageBuilder message;
+  auto list = message.initRoot<TestAllTypes>().structList.init(5);
+  int32_t keys[] = {40, 10, 30, 10, 20};
+  const char* texts[] = {"d", "a", "c", "b", "e"};
+  for (uint i = 0; i < 5; i++) {
+    list[i].int32Field = keys[i];
+    list[i].textField = texts[i];
+  }
+  auto reader = list.asReader();
+
+  auto index = altcxx::indexBy<TestAllTypes>(
+      reader, altcxx::fieldKey(&TestAllTypes::Reader::int32Field));
+  ASSERT_EQ(5u, index.size());
+  EXPECT_EQ_CAST(10, index[0].int32Field);
+  EXPECT_EQ("a", index[0].textField.get());
+  EXPECT_EQ("b", index[1].textField.get());
+  EXPECT_EQ_CAST(40, index[4].int32Field);
+
+  auto range = index.equalRange(10);
+  EXPECT_EQ(0u, range.first);
+  EXPECT_EQ(2u, range.second);
+
+  KJ_IF_MAYBE(found, index.find(30)) {
+    EXPECT_EQ("c", found->textField.get());
+  } else {
+    ADD_FAILURE() << "Expected to find 30.";
+  }
+  EXPECT_TRUE(index.find(25) == nullptr);
+  EXPECT_TRUE(index.find(50) == nullptr);
+
+  auto textIndex = altcxx::indexBy<TestAllTypes>(
+      reader, altcxx::fieldKey(&TestAllTypes::Reader::textField));
+  EXPECT_EQ_CAST(20, textIndex[4].int32Field);
+  EXPECT_TRUE(textIndex.find("b") != nullptr);
+  EXPECT_TRUE(textIndex.find("f") == nullptr);
+}
+
+TEST(ListIndex, StoredOrder) {
+  MallocMessageBuilder message;
+  auto root = message.initRoot<TestAllTypes>();
+  auto list = root.structList.init(4);
+  for (uint i = 0; i < 4; i++) {
+    list[i].uInt32Field = 100 - i;
+  }
+
+  auto byValue = [](TestAllTypes::Reader reader) -> uint32_t { return reader.uInt32Field; };
+  auto index = altcxx::indexBy<TestAllTypes>(list.asReader(), byValue);
+  index.writeOrder(root.uInt32List.init(4));
+
+  auto reader = root.asReader();
+  altcxx::ListIndex<TestAllTypes, decltype(byValue)> stored(
+      reader.structList.get(), byValue, reader.uInt32List.get());
+  EXPECT_EQ_CAST(97u, stored[0].uInt32Field);
+  EXPECT_TRUE(stored.find(99) != nullptr);
+
+  EXPECT_ANY_THROW((altcxx::ListIndex<TestAllTypes, decltype(byValue)>(
+      reader.structList.get(), byValue, List<uint32_t>::Reader())));
+
+  // Entries are checked when a lookup reaches them.
+  root.uInt32List.get().set(0, 4);
+  altcxx::ListIndex<TestAllTypes, decltype(byValue)> corrupt(
+      reader.structList.get(), byValue, reader.uInt32List.get());
+  EXPECT_ANY_THROW(corrupt[0]);
+  EXPECT_EQ_CAST(98u, corrupt[1].uInt32Field);
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,121 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/list-sort.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(ListSort, Sort) {
+  MallocMessageBuilder message;
+  auto list = message.initRoot<TestAllTypes>().structList.init(6);
+  int32_t keys[] = {5, 3, 9, 3, 1, 7};
+  for (uint i = 0; i < list.size(); i++) {
+    list[i].int32Field = keys[i];
+    list[i].textField = kj::str("text", keys[i], "-", i).cStr();
+    list[i].structField.init().uInt16Field = i;
+    auto int8List = list[i].int8List.init(2);
+    int8List.set(0, keys[i]);
+    int8List.set(1, i);
+  }
+
+  altcxx::sortBy<TestAllTypes>(list, altcxx::fieldKey(&TestAllTypes::Reader::int32Field));
+
+  // Pointers must still be valid after the move, so go through a checked reader.
+  auto flat = messageToFlatArray(message);
+  FlatArrayMessageReader reader(flat);
+  auto sorted = reader.getRoot<TestAllTypes>().structList.get();
+  uint expectedOrder[] = {4, 1, 3, 0, 5, 2};
+  for (uint i = 0; i < sorted.size(); i++) {
+    uint from = expectedOrder[i];
+    EXPECT_EQ_CAST(keys[from], sorted[i].int32Field);
+    EXPECT_EQ(kj::str("text", keys[from], "-", from), sorted[i].textField.get());
+    EXPECT_EQ_CAST(from, sorted[i].structField.uInt16Field);
+    ASSERT_EQ(2u, sorted[i].int8List.size());
+    EXPECT_EQ(keys[from], sorted[i].int8List.get()[0]);
+    EXPECT_EQ(int8_t(from), sorted[i].int8List.get()[1]);
+  }
+}
+
+TEST(ListSort, AdjacentTarget) {
+  typedef test::TestNestedTypes::NestedStruct::NestedEnum Inner;
+
+  MallocMessageBuilder message;
+  auto list = message.initRoot<test::TestAnyPointer>()
+      .anyPointerField.initAs<List<test::TestNestedTypes>>(3);
+  // Allocated right behind the list, so the last element points to it with offset 0.
+  list[2].nestedStruct.init().innerNestedEnum = Inner::BAZ;
+  list[2].outerNestedEnum = test::TestNestedTypes::NestedEnum::FOO;
+  list[0].nestedStruct.init().innerNestedEnum = Inner::QUX;
+  list[1].nestedStruct.init().innerNestedEnum = Inner::QUUX;
+
+  altcxx::sortBy<test::TestNestedTypes>(
+      list, altcxx::fieldKey(&test::TestNestedTypes::Reader::outerNestedEnum));
+
+  auto flat = messageToFlatArray(message);
+  FlatArrayMessageReader reader(flat);
+  auto sorted = reader.getRoot<test::TestAnyPointer>()
+      .anyPointerField.getAs<List<test::TestNestedTypes>>();
+  EXPECT_EQ_CAST(Inner::BAZ, sorted[0].nestedStruct.innerNestedEnum);
+  EXPECT_EQ_CAST(Inner::QUX, sorted[1].nestedStruct.innerNestedEnum);
+  EXPECT_EQ_CAST(Inner::QUUX, sorted[2].nestedStruct.innerNestedEnum);
+}
+
+TEST(ListSort, Merge) {
+  MallocMessageBuilder messageA, messageB, message;
+  auto a = messageA.initRoot<TestAllTypes>().structList.init(3);
+  auto b = messageB.initRoot<TestAllTypes>().structList.init(2);
+  a[0].textField = "apple";
+  a[1].textField = "cherry";
+  a[2].textField = "plum";
+  b[0].textField = "banana";
+  b[1].textField = "cherry";
+  b[1].int32Field = 1;
+
+  auto merged = message.initRoot<TestAllTypes>().structList.init(5);
+  List<TestAllTypes>::Reader inputs[] = {a.asReader(), b.asReader()};
+  altcxx::mergeBy<TestAllTypes>(merged, kj::arrayPtr(inputs, 2),
+                                altcxx::fieldKey(&TestAllTypes::Reader::textField));
+
+  auto reader = merged.asReader();
+  EXPECT_EQ("apple", reader[0].textField.get());
+  EXPECT_EQ("banana", reader[1].textField.get());
+  EXPECT_EQ("cherry", reader[2].textField.get());
+  EXPECT_EQ_CAST(0, reader[2].int32Field);
+  EXPECT_EQ_CAST(1, reader[3].int32Field);
+  EXPECT_EQ("plum", reader[4].textField.get());
+
+  auto less = altcxx::compareBy(altcxx::fieldKey(&TestAllTypes::Reader::textField));
+  EXPECT_TRUE(less(reader[0], reader[1]));
+  EXPECT_FALSE(less(reader[2], reader[3]));
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,83 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Time to pack and unpack with the altcxx codec against the one in libcapnp, on 1000 copies of
+// the message built by initTestMessage().  Build with -mssse3 or -march=native to measure the
+// SIMD paths.
+
+#include <capnp/altc++/packed.h>
+#include <capnp/message.h>
+#include <capnp/serialize-packed.h>
+#include "bench.h"
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+
+void benchPacked() {
+  MallocMessageBuilder builder;
+  auto list = builder.initRoot<TestAllTypes>().structList.init(1000);
+  for (uint i = 0; i < list.size(); i++) {
+    initTestMessage(list[i]);
+  }
+  auto flat = messageToFlatArray(builder);
+  size_t bytes = flat.size() * sizeof(word);
+
+  auto packedBuffer = kj::heapArray<byte>(flat.size() * 10 + 16);
+  auto unpackedBuffer = kj::heapArray<word>(flat.size());
+
+  auto pack = [&](bool altcxx) {
+    kj::ArrayOutputStream output(packedBuffer);
+    if (altcxx) {
+      altcxx::PackedOutputStream packed(output);
+      packed.write(flat.begin(), bytes);
+    } else {
+      PackedOutputStream packed(output);
+      packed.write(flat.begin(), bytes);
+    }
+    return output.getArray();
+  };
+
+  auto packed = pack(false);
+  auto unpack = [&](bool altcxx) {
+    kj::ArrayInputStream input(packed);
+    if (altcxx) {
+      altcxx::PackedInputStream unpacked(input);
+      unpacked.read(unpackedBuffer.begin(), bytes);
+    } else {
+      PackedInputStream unpacked(input);
+      unpacked.read(unpackedBuffer.begin(), bytes);
+    }
+  };
+
+  printf("packed codec, %zu bytes packing to %zu, %s\n", bytes, packed.size(),
+         CAPNP_ALTCXX_PACKED_SIMD ? "SIMD" : "portable");
+  runBenchmark("pack, capnp", 1, [&]() { doNotOptimize(pack(false).size()); });
+  runBenchmark("pack, altcxx", 1, [&]() { doNotOptimize(pack(true).size()); });
+  runBenchmark("unpack, capnp", 1, [&]() { unpack(false); });
+  runBenchmark("unpack, altcxx", 1, [&]() { unpack(true); });
+}
+
+}  // namespace _ (private)
+}  // namespace capnp
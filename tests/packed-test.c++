@@ -0,0 +1,141 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/packed.h>
+#include <capnp/message.h>
+#include <capnp/serialize-packed.h>
+#include <gtest/gtest.h>
+#include <random>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+kj::Array<byte> referencePack(kj::ArrayPtr<const word> words) {
+  auto buffer = kj::heapArray<byte>(words.size() * 10 + 16);
+  kj::ArrayOutputStream output(buffer);
+  {
+    PackedOutputStream packed(output);
+    packed.write(words.begin(), words.size() * sizeof(word));
+  }
+  return kj::heapArray(output.getArray());
+}
+
+kj::Array<byte> altcxxPack(kj::ArrayPtr<const word> words, size_t bufferSize) {
+  auto result = kj::heapArray<byte>(words.size() * 10 + 16);
+  kj::ArrayOutputStream array(result);
+  {
+    // A small buffer makes the stream go through its scratch buffer.
+    auto buffer = kj::heapArray<byte>(bufferSize);
+    kj::BufferedOutputStreamWrapper output(array, buffer);
+    altcxx::PackedOutputStream packed(output);
+    packed.write(words.begin(), words.size() * sizeof(word));
+    output.flush();
+  }
+  return kj::heapArray(array.getArray());
+}
+
+kj::Array<word> altcxxUnpack(kj::ArrayPtr<const byte> packed, size_t words, size_t bufferSize) {
+  kj::ArrayInputStream array(packed);
+  auto buffer = kj::heapArray<byte>(bufferSize);
+  kj::BufferedInputStreamWrapper input(array, buffer);
+  altcxx::PackedInputStream unpacked(input);
+
+  auto result = kj::heapArray<word>(words);
+  // Read in uneven pieces to stop in the middle of runs.
+  size_t done = 0;
+  while (done < words) {
+    size_t count = kj::min(words - done, done % 7 + 1);
+    unpacked.read(result.begin() + done, count * sizeof(word));
+    done += count;
+  }
+  return result;
+}
+
+TEST(Packed, Fuzz) {
+  std::mt19937 random(1234);
+  for (int iteration = 0; iteration < 2000; iteration++) {
+    auto words = kj::heapArray<word>(random() % 600 + 1);
+    byte* bytes = reinterpret_cast<byte*>(words.begin());
+
+    // Vary the density of zero bytes, to cover all kinds of runs.
+    uint nonzeroPercent = random() % 101;
+    for (size_t i = 0; i < words.size() * sizeof(word); i++) {
+      bytes[i] = random() % 100 < nonzeroPercent ? random() % 255 + 1 : 0;
+    }
+
+    auto expected = referencePack(words);
+    auto packed = altcxxPack(words, random() % 4 == 0 ? 64 : 8192);
+    ASSERT_EQ(expected.size(), packed.size());
+    ASSERT_EQ(0, memcmp(expected.begin(), packed.begin(), packed.size()));
+
+    auto unpacked = altcxxUnpack(packed, words.size(), random() % 30 + 1);
+    ASSERT_EQ(0, memcmp(words.begin(), unpacked.begin(), words.size() * sizeof(word)));
+  }
+}
+
+TEST(Packed, Message) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  auto expected = kj::heapArray<byte>(4096);
+  kj::ArrayOutputStream expectedOutput(expected);
+  writePackedMessage(expectedOutput, builder);
+
+  auto packed = kj::heapArray<byte>(4096);
+  kj::ArrayOutputStream output(packed);
+  altcxx::writePackedMessage(output, builder);
+  ASSERT_EQ(expectedOutput.getArray().size(), output.getArray().size());
+  EXPECT_EQ(0, memcmp(expected.begin(), packed.begin(), output.getArray().size()));
+
+  {
+    kj::ArrayInputStream input(output.getArray());
+    altcxx::PackedMessageReader reader(input);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+  {
+    kj::ArrayInputStream input(output.getArray());
+    PackedMessageReader reader(input);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+TEST(Packed, PrematureEof) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto packed = kj::heapArray<byte>(4096);
+  kj::ArrayOutputStream output(packed);
+  altcxx::writePackedMessage(output, builder);
+
+  kj::ArrayInputStream input(output.getArray().slice(0, output.getArray().size() / 2));
+  EXPECT_ANY_THROW({
+    altcxx::PackedMessageReader reader(input);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  });
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
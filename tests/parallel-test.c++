@@ -0,0 +1,104 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/parallel.h>
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include <kj/debug.h>
+#include <atomic>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(Parallel, For) {
+  MallocMessageBuilder message;
+  auto list = message.initRoot<TestAllTypes>().structList.init(10000);
+  for (uint i = 0; i < list.size(); i++) {
+    list[i].uInt32Field = i;
+  }
+
+  altcxx::WorkStealingPool pool(4);
+  std::vector<std::atomic<int>> seen(list.size());
+  std::atomic<uint64_t> sum(0);
+  altcxx::parallelFor(pool, list.asReader(), [&](uint index, TestAllTypes::Reader element) {
+    seen[index]++;
+    sum += element.uInt32Field;
+  }, 64);
+
+  EXPECT_EQ(10000ull * 9999 / 2, sum.load());
+  for (auto& count: seen) {
+    EXPECT_EQ(1, count.load());
+  }
+}
+
+TEST(Parallel, ReduceIsDeterministic) {
+  MallocMessageBuilder message;
+  auto list = message.initRoot<TestAllTypes>().structList.init(5000);
+  for (uint i = 0; i < list.size(); i++) {
+    list[i].float64Field = 1.0 / (i + 1);
+  }
+
+  auto map = [](TestAllTypes::Reader element) -> double { return element.float64Field; };
+  auto add = [](double a, double b) { return a + b; };
+
+  altcxx::WorkStealingPool one(1);
+  altcxx::WorkStealingPool many(8);
+  double expected = altcxx::parallelReduce(one, list.asReader(), 0.0, map, add, 100);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(expected, altcxx::parallelReduce(many, list.asReader(), 0.0, map, add, 100));
+  }
+}
+
+TEST(Parallel, ReduceBool) {
+  MallocMessageBuilder message;
+  auto list = message.initRoot<TestAllTypes>().structList.init(5000);
+  list[4321].boolField = true;
+
+  auto map = [](TestAllTypes::Reader element) -> bool { return element.boolField; };
+  auto any = [](bool a, bool b) { return a || b; };
+
+  altcxx::WorkStealingPool pool(8);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(altcxx::parallelReduce(pool, list.asReader(), false, map, any, 10));
+  }
+  list[4321].boolField = false;
+  EXPECT_FALSE(altcxx::parallelReduce(pool, list.asReader(), false, map, any, 10));
+}
+
+TEST(Parallel, Exception) {
+  altcxx::WorkStealingPool pool(4);
+  EXPECT_ANY_THROW(pool.run(100, [](uint task) {
+    KJ_REQUIRE(task != 42);
+  }));
+
+  std::atomic<uint> count(0);
+  pool.run(100, [&](uint) { count++; });
+  EXPECT_EQ(100u, count.load());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,205 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/result-cache.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+class TestCacheableImpl final: public test::TestCacheable::Server {
+public:
+  TestCacheableImpl() = default;
+  explicit TestCacheableImpl(bool& destroyed): destroyed(&destroyed) {}
+  ~TestCacheableImpl() {
+    if (destroyed != nullptr) *destroyed = true;
+  }
+
+  kj::Promise<void> lookup(LookupContext context) override {
+    auto results = context.getResults();
+    results.value = kj::str("value of ", context.getParams().key.get()).cStr();
+    results.serial = ++serial;
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> expiring(ExpiringContext context) override {
+    context.getResults().serial = ++serial;
+    return kj::READY_NOW;
+  }
+
+private:
+  uint serial = 0;
+  bool* destroyed = nullptr;
+};
+
+TEST(ResultCache, HitsAndMisses) {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto& cache = altcxx::ResultCache::forThread();
+  cache.invalidate();
+  uint64_t hits = cache.getHits();
+  uint64_t misses = cache.getMisses();
+
+  test::TestCacheable::Client client = kj::heap<TestCacheableImpl>();
+  auto lookup = [&](kj::StringPtr key) {
+    auto request = client.lookupRequest();
+    request.key = key;
+    auto response = client.lookupCached(kj::mv(request)).wait(waitScope);
+    EXPECT_EQ(kj::str("value of ", key), response.value.get());
+    return uint32_t(response.serial);
+  };
+
+  EXPECT_EQ(1u, lookup("foo"));
+  EXPECT_EQ(1u, lookup("foo"));
+  EXPECT_EQ(2u, lookup("bar"));
+  EXPECT_EQ(1u, lookup("foo"));
+  EXPECT_EQ(hits + 2, cache.getHits());
+  EXPECT_EQ(misses + 2, cache.getMisses());
+
+  // Plain requests skip the cache.
+  auto request = client.lookupRequest();
+  request.key = "foo";
+  EXPECT_EQ(3u, uint32_t(request.send().wait(waitScope).serial));
+
+  // Other clients of the same capability share entries.
+  auto copy = client.castAs<test::TestCacheable>();
+  auto copyRequest = copy.lookupRequest();
+  copyRequest.key = "bar";
+  EXPECT_EQ(2u, uint32_t(copy.lookupCached(kj::mv(copyRequest)).wait(waitScope).serial));
+
+  client.invalidateCachedResults();
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_EQ(4u, lookup("foo"));
+
+  // A different capability has entries of its own.
+  test::TestCacheable::Client other = kj::heap<TestCacheableImpl>();
+  auto otherRequest = other.lookupRequest();
+  otherRequest.key = "foo";
+  EXPECT_EQ(1u, uint32_t(other.lookupCached(kj::mv(otherRequest)).wait(waitScope).serial));
+
+  cache.invalidate();
+}
+
+TEST(ResultCache, ExpiryAndEviction) {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto& cache = altcxx::ResultCache::forThread();
+  cache.invalidate();
+
+  test::TestCacheable::Client client = kj::heap<TestCacheableImpl>();
+  auto expiring = [&](kj::StringPtr key) {
+    auto request = client.expiringRequest();
+    request.key = key;
+    return uint32_t(client.expiringCached(kj::mv(request)).wait(waitScope).serial);
+  };
+
+  EXPECT_EQ(1u, expiring("foo"));
+  usleep(5000);
+  EXPECT_EQ(2u, expiring("foo"));
+
+  cache.setCapacity(2);
+  auto lookup = [&](kj::StringPtr key) {
+    auto request = client.lookupRequest();
+    request.key = key;
+    return uint32_t(client.lookupCached(kj::mv(request)).wait(waitScope).serial);
+  };
+  EXPECT_EQ(3u, lookup("a"));
+  EXPECT_EQ(4u, lookup("b"));
+  EXPECT_EQ(3u, lookup("a"));
+  EXPECT_EQ(5u, lookup("c"));  // Evicts "b", the least recently used.
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(3u, lookup("a"));
+  EXPECT_EQ(6u, lookup("b"));
+
+  cache.setCapacity(1024);
+  cache.invalidate();
+}
+
+TEST(ResultCache, InvalidateWhileInFlight) {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto& cache = altcxx::ResultCache::forThread();
+  cache.invalidate();
+
+  test::TestCacheable::Client client = kj::heap<TestCacheableImpl>();
+  auto request = client.lookupRequest();
+  request.key = "foo";
+  auto promise = client.lookupCached(kj::mv(request));
+  client.invalidateCachedResults();
+  EXPECT_EQ(1u, uint32_t(promise.wait(waitScope).serial));
+  EXPECT_EQ(0u, cache.size());
+
+  // Later calls are cached again.
+  auto lookup = [&]() {
+    auto request = client.lookupRequest();
+    request.key = "foo";
+    return uint32_t(client.lookupCached(kj::mv(request)).wait(waitScope).serial);
+  };
+  EXPECT_EQ(2u, lookup());
+  EXPECT_EQ(2u, lookup());
+
+  auto allRequest = client.lookupRequest();
+  allRequest.key = "bar";
+  promise = client.lookupCached(kj::mv(allRequest));
+  cache.invalidate();
+  EXPECT_EQ(3u, uint32_t(promise.wait(waitScope).serial));
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST(ResultCache, ReleasesCapabilities) {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto& cache = altcxx::ResultCache::forThread();
+  cache.invalidate();
+
+  bool destroyed = false;
+  auto lookup = [&](test::TestCacheable::Client& client) {
+    auto request = client.lookupRequest();
+    request.key = "foo";
+    return uint32_t(client.lookupCached(kj::mv(request)).wait(waitScope).serial);
+  };
+
+  {
+    test::TestCacheable::Client client = kj::heap<TestCacheableImpl>(destroyed);
+    EXPECT_EQ(1u, lookup(client));
+    EXPECT_EQ(1u, lookup(client));
+    EXPECT_EQ(1u, cache.size());
+  }
+  EXPECT_FALSE(destroyed);
+
+  // The next result added lets go of the capability no one else holds.
+  test::TestCacheable::Client other = kj::heap<TestCacheableImpl>();
+  EXPECT_EQ(1u, lookup(other));
+  EXPECT_TRUE(destroyed);
+  EXPECT_EQ(1u, cache.size());
+
+  cache.invalidate();
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,116 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/snapshot.h>
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include <kj/vector.h>
+#include <thread>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(Snapshot, Publish) {
+  altcxx::SnapshotCache<TestAllTypes> cache;
+  EXPECT_EQ(0u, cache.getVersion());
+
+  {
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    EXPECT_EQ(1u, cache.publish(builder.getRoot<AnyPointer>().asReader()));
+  }
+
+  auto snapshot = cache.get();
+  EXPECT_EQ(1u, snapshot->getVersion());
+  checkTestMessage(snapshot->getRoot());
+
+  {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().int32Field = 123;
+    auto flat = messageToFlatArray(builder);
+    EXPECT_EQ(2u, cache.publish(flat.asPtr()));
+  }
+
+  // Old snapshots stay valid while referenced.
+  checkTestMessage(snapshot->getRoot());
+  EXPECT_EQ_CAST(123, cache.get()->getRoot().int32Field);
+}
+
+TEST(Snapshot, InvalidMessage) {
+  altcxx::SnapshotCache<TestAllTypes> cache;
+  word garbage[2];
+  memset(garbage, 0xff, sizeof(garbage));
+  EXPECT_ANY_THROW(cache.publish(kj::arrayPtr(garbage, 2)));
+  EXPECT_EQ(0u, cache.getVersion());
+}
+
+TEST(Snapshot, LocalReaders) {
+  altcxx::SnapshotCache<TestAllTypes> cache;
+
+  auto publish = [&](int32_t value) {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().int32Field = value;
+    cache.publish(builder.getRoot<AnyPointer>().asReader());
+  };
+
+  publish(0);
+
+  std::atomic<bool> done(false);
+  kj::Vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.add([&]() {
+      altcxx::SnapshotCache<TestAllTypes>::LocalReader reader(cache);
+      int32_t last = 0;
+      while (!done) {
+        int32_t value = reader.get().int32Field;
+        EXPECT_LE(last, value);
+        last = value;
+      }
+    });
+  }
+
+  for (int32_t i = 1; i <= 100; i++) {
+    publish(i);
+  }
+  done = true;
+
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  altcxx::SnapshotCache<TestAllTypes>::LocalReader reader(cache);
+  EXPECT_EQ_CAST(100, reader.get().int32Field);
+
+  // A Reader from get() may dangle after the next get(); a pinned snapshot stays readable.
+  auto pinned = reader.getSnapshot();
+  publish(101);
+  EXPECT_EQ_CAST(101, reader.get().int32Field);
+  EXPECT_EQ_CAST(100, pinned->getRoot().int32Field);
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
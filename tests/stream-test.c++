@@ -0,0 +1,183 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/batch.h>
+#include <capnp/altc++/stream.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+void writeLog(int fd, uint count) {
+  // Message 7 gets a large text of its own, the rest are small and multi-segment.
+  altcxx::MessageBatch batch;
+  for (uint i = 0; i < count; i++) {
+    auto message = kj::heap<MallocMessageBuilder>(4, AllocationStrategy::FIXED_SIZE);
+    auto root = message->initRoot<TestAllTypes>();
+    root.uInt32Field = i;
+    if (i == 7) {
+      auto text = kj::heapString(100000);
+      memset(text.begin(), 'x', text.size());
+      root.textField = text.cStr();
+    } else {
+      root.textField = kj::str("message ", i).cStr();
+    }
+    batch.add(kj::mv(message));
+  }
+  batch.write(fd);
+}
+
+TEST(Stream, ReadsLog) {
+  FILE* file = tmpfile();
+  ASSERT_TRUE(file != nullptr);
+  KJ_DEFER(fclose(file));
+  int fd = fileno(file);
+  writeLog(fd, 1000);
+  KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
+
+  altcxx::MessageStream<TestAllTypes>::Options options;
+  options.chunkWords = 1024;
+  options.readahead = 2;
+  altcxx::MessageStream<TestAllTypes> stream(fd, options);
+
+  // Messages stay readable while later ones are read.
+  kj::Vector<kj::Own<altcxx::MessageStream<TestAllTypes>::Message>> kept;
+  uint count = 0;
+  for (;;) {
+    auto message = stream.next();
+    if (message == nullptr) break;
+    auto root = message->getRoot();
+    EXPECT_EQ_CAST(count, root.uInt32Field);
+    if (count == 7) {
+      EXPECT_EQ(100000u, root.textField.get().size());
+    } else {
+      EXPECT_EQ(kj::str("message ", count), root.textField.get());
+    }
+    if (count % 100 == 0) kept.add(kj::mv(message));
+    count++;
+  }
+  EXPECT_EQ(1000u, count);
+  EXPECT_TRUE(stream.next() == nullptr);
+
+  for (uint i = 0; i < kept.size(); i++) {
+    EXPECT_EQ(kj::str("message ", i * 100), kept[i]->getRoot().textField.get());
+  }
+}
+
+TEST(Stream, Pipe) {
+  int fds[2];
+  KJ_SYSCALL(pipe(fds));
+  kj::AutoCloseFd readEnd(fds[0]), writeEnd(fds[1]);
+
+  std::thread writer([&]() {
+    writeLog(writeEnd, 100);
+    writeEnd = nullptr;
+  });
+
+  altcxx::MessageStream<TestAllTypes> stream(readEnd);
+  uint count = 0;
+  for (;;) {
+    auto message = stream.next();
+    if (message == nullptr) break;
+    EXPECT_EQ_CAST(count++, message->getRoot().uInt32Field);
+  }
+  EXPECT_EQ(100u, count);
+  writer.join();
+}
+
+TEST(Stream, PrematureEof) {
+  FILE* file = tmpfile();
+  ASSERT_TRUE(file != nullptr);
+  KJ_DEFER(fclose(file));
+  int fd = fileno(file);
+  writeLog(fd, 10);
+  off_t size;
+  KJ_SYSCALL(size = lseek(fd, 0, SEEK_END));
+  KJ_SYSCALL(ftruncate(fd, size - sizeof(word)));
+  KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
+
+  // Complete messages come through before the error.
+  altcxx::MessageStream<TestAllTypes> stream(fd);
+  for (uint i = 0; i < 9; i++) {
+    auto message = stream.next();
+    ASSERT_TRUE(message != nullptr);
+    EXPECT_EQ_CAST(i, message->getRoot().uInt32Field);
+  }
+  EXPECT_ANY_THROW(stream.next());
+}
+
+TEST(Stream, ShortReads) {
+  // Each message is handed off as soon as it's in, without waiting for more to fill the chunk.
+  int fds[2];
+  KJ_SYSCALL(pipe(fds));
+  kj::AutoCloseFd readEnd(fds[0]), writeEnd(fds[1]);
+
+  altcxx::MessageStream<TestAllTypes> stream(readEnd);
+  for (uint i = 0; i < 3; i++) {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().uInt32Field = i;
+    writeMessageToFd(writeEnd, builder);
+
+    auto message = stream.next();
+    ASSERT_TRUE(message != nullptr);
+    EXPECT_EQ_CAST(i, message->getRoot().uInt32Field);
+  }
+  writeEnd = nullptr;
+  EXPECT_TRUE(stream.next() == nullptr);
+}
+
+TEST(Stream, CorruptTable) {
+  FILE* file = tmpfile();
+  ASSERT_TRUE(file != nullptr);
+  KJ_DEFER(fclose(file));
+  int fd = fileno(file);
+  writeLog(fd, 10);
+  _::WireValue<uint32_t> table[2];
+  table[0].set(1000);  // Too many segments.
+  table[1].set(0);
+  KJ_SYSCALL(write(fd, table, sizeof(table)));
+  writeLog(fd, 10);
+  KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
+
+  // The messages before the bad table come through before the error.
+  altcxx::MessageStream<TestAllTypes> stream(fd);
+  for (uint i = 0; i < 10; i++) {
+    auto message = stream.next();
+    ASSERT_TRUE(message != nullptr);
+    EXPECT_EQ_CAST(i, message->getRoot().uInt32Field);
+  }
+  EXPECT_ANY_THROW(stream.next());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
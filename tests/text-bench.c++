@@ -0,0 +1,64 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Throughput of the generated text and JSON writers against capnp's reflection-based
+// stringification, on the message built by initTestMessage().
+
+#include <capnp/altc++/text.h>
+#include <capnp/message.h>
+#include "bench.h"
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+
+void benchText() {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto reader = builder.getRoot<TestAllTypes>().asReader();
+  auto structReader = altcxx::ReaderImpl::asStruct(&reader);
+
+  size_t textSize = altcxx::toText(reader).size();
+  size_t jsonSize = altcxx::toJson(reader).size();
+
+  altcxx::TextWriter textWriter(altcxx::TextWriter::Format::TEXT);
+  altcxx::TextWriter jsonWriter(altcxx::TextWriter::Format::JSON);
+
+  printf("text output, %zu bytes of text, %zu of JSON\n", textSize, jsonSize);
+  runBenchmark("structString", 1, [&]() {
+    doNotOptimize(structString<TestAllTypes>(structReader).flatten().size());
+  });
+  runBenchmark("toText", 1, [&]() { doNotOptimize(altcxx::toText(reader).size()); });
+  runBenchmark("reused text writer", 1, [&]() {
+    textWriter.clear();
+    doNotOptimize(textWriter.write(reader).getText().size());
+  });
+  runBenchmark("reused JSON writer", 1, [&]() {
+    jsonWriter.clear();
+    doNotOptimize(jsonWriter.write(reader).getText().size());
+  });
+}
+
+}  // namespace _ (private)
+}  // namespace capnp
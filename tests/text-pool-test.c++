@@ -0,0 +1,116 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/text-pool.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+const char* NAMES[] = {"red", "green", "blue"};
+
+size_t buildList(MallocMessageBuilder& message, altcxx::TextPool* pool) {
+  auto list = message.initRoot<TestAllTypes>().structList.init(300);
+  for (uint i = 0; i < list.size(); i++) {
+    auto element = list[i];
+    if (pool == nullptr) {
+      element.textField = NAMES[i % 3];
+      element.dataField = data(NAMES[i % 2]);
+    } else {
+      pool->set(element.textField, NAMES[i % 3]);
+      pool->set(element.dataField, data(NAMES[i % 2]));
+    }
+  }
+
+  size_t words = 0;
+  for (auto segment: message.getSegmentsForOutput()) {
+    words += segment.size();
+  }
+  return words;
+}
+
+TEST(TextPool, Dedup) {
+  MallocMessageBuilder plain(8192);
+  size_t plainWords = buildList(plain, nullptr);
+
+  MallocMessageBuilder pooled(8192);
+  altcxx::TextPool pool(pooled);
+  size_t pooledWords = buildList(pooled, &pool);
+
+  EXPECT_EQ(600u - 5u, pool.getSavedWords());
+  EXPECT_EQ(plainWords - pool.getSavedWords(), pooledWords);
+
+  // The result passes validation like any other message.
+  auto flat = messageToFlatArray(pooled);
+  FlatArrayMessageReader reader(flat);
+  auto list = reader.getRoot<TestAllTypes>().structList.get();
+  ASSERT_EQ(300u, list.size());
+  for (uint i = 0; i < list.size(); i++) {
+    EXPECT_EQ(NAMES[i % 3], list[i].textField.get());
+    EXPECT_EQ(data(NAMES[i % 2]), list[i].dataField.get());
+  }
+}
+
+TEST(TextPool, LongValues) {
+  MallocMessageBuilder message;
+  altcxx::TextPool pool(message, 4);
+  auto list = message.initRoot<TestAllTypes>().structList.init(2);
+  auto e0 = list[0];
+  auto e1 = list[1];
+  pool.set(e0.textField, "long value");
+  pool.set(e1.textField, "long value");
+  EXPECT_EQ(0u, pool.getSavedWords());
+  EXPECT_NE(e0.textField.begin(), e1.textField.begin());
+}
+
+TEST(TextPool, SetTwice) {
+  MallocMessageBuilder message;
+  altcxx::TextPool pool(message, 8);
+  auto list = message.initRoot<TestAllTypes>().structList.init(3);
+  auto e0 = list[0];
+  auto e1 = list[1];
+  auto e2 = list[2];
+  pool.set(e0.textField, "red");
+  pool.set(e1.textField, "red");
+  pool.set(e2.textField, "red");
+
+  // Re-setting one alias, pooled or not, leaves the shared copy to the others.
+  pool.set(e0.textField, "blue");
+  pool.set(e1.textField, "a long value");
+  EXPECT_EQ("blue", e0.textField.get());
+  EXPECT_EQ("a long value", e1.textField.get());
+  EXPECT_EQ("red", e2.textField.get());
+
+  pool.set(e0.textField, "red");
+  EXPECT_EQ("red", e0.textField.get());
+  EXPECT_EQ(e0.textField.begin(), e2.textField.begin());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,129 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/text.h>
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(Text, InlineStructs) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestPrintInlineStructs>();
+  root.someText = "foo";
+  auto list = root.structList.init(2);
+  list[0].int32Field = 123;
+  list[0].textField = "bar";
+  list[1].int32Field = 456;
+  list[1].textField = "baz";
+  auto reader = root.asReader();
+
+  EXPECT_EQ("(someText = \"foo\", structList = [(int32Field = 123, textField = \"bar\"), "
+            "(int32Field = 456, textField = \"baz\")])", altcxx::toText(reader));
+  EXPECT_EQ("{\"someText\":\"foo\",\"structList\":[{\"int32Field\":123,\"textField\":\"bar\"},"
+            "{\"int32Field\":456,\"textField\":\"baz\"}]}", altcxx::toJson(reader));
+  EXPECT_EQ(altcxx::toText(reader), kj::str(reader));
+  EXPECT_EQ(altcxx::toText(reader), kj::str(root));
+}
+
+TEST(Text, Values) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.int64Field = -123456789012345ll;
+  root.float32Field = 1234.5;
+  root.textField = "a\"b\n\x01";
+  root.dataField = Data::Reader(reinterpret_cast<const byte*>("\xff\x00"), 2);
+  root.enumField = TestEnum::CORGE;
+  auto enums = root.enumList.init(2);
+  enums.set(0, TestEnum::FOO);
+  enums.set(1, TestEnum::GARPLY);
+  auto reader = root.asReader();
+
+  auto text = altcxx::toText(reader);
+  EXPECT_TRUE(strstr(text.cStr(), "(voidField = void, boolField = false, int8Field = 0,"));
+  EXPECT_TRUE(strstr(text.cStr(), "int64Field = -123456789012345,"));
+  EXPECT_TRUE(strstr(text.cStr(), "float32Field = 1234.5,"));
+  EXPECT_TRUE(strstr(text.cStr(), "textField = \"a\\\"b\\n\\x01\","));
+  EXPECT_TRUE(strstr(text.cStr(), "dataField = \"\\xff\\x00\","));
+  EXPECT_TRUE(strstr(text.cStr(), "enumField = corge,"));
+  EXPECT_TRUE(strstr(text.cStr(), "enumList = [foo, garply]"));
+  EXPECT_FALSE(strstr(text.cStr(), "structField"));
+
+  auto json = altcxx::toJson(reader);
+  EXPECT_TRUE(strstr(json.cStr(), "{\"voidField\":null,\"boolField\":false,\"int8Field\":0,"));
+  EXPECT_TRUE(strstr(json.cStr(), "\"int64Field\":\"-123456789012345\","));
+  EXPECT_TRUE(strstr(json.cStr(), "\"textField\":\"a\\\"b\\n\\u0001\","));
+  EXPECT_TRUE(strstr(json.cStr(), "\"dataField\":[255,0],"));
+  EXPECT_TRUE(strstr(json.cStr(), "\"enumField\":\"corge\","));
+  EXPECT_TRUE(strstr(json.cStr(), "\"enumList\":[\"foo\",\"garply\"]"));
+}
+
+TEST(Text, MatchesStructString) {
+  // The text format is the one capnp's reflection-based stringification produces.
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto reader = builder.getRoot<TestAllTypes>().asReader();
+
+  EXPECT_EQ(kj::str(structString<TestAllTypes>(altcxx::ReaderImpl::asStruct(&reader))),
+            altcxx::toText(reader));
+
+  altcxx::TextWriter writer(altcxx::TextWriter::Format::TEXT);
+  EXPECT_EQ(altcxx::toText(reader), kj::str(writer.write(reader).getText()));
+}
+
+TEST(Text, Unions) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnnamedUnion>();
+  root.before = "foo";
+  root.bar = 321;
+  root.after = "bar";
+
+  EXPECT_EQ("(before = \"foo\", bar = 321, middle = 0, after = \"bar\")",
+            altcxx::toText(root.asReader()));
+
+  root.foo = 123;
+  EXPECT_EQ("{\"before\":\"foo\",\"foo\":123,\"middle\":0,\"after\":\"bar\"}",
+            altcxx::toJson(root.asReader()));
+}
+
+TEST(Text, ReuseWriter) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnnamedUnion>();
+  root.foo = 1;
+
+  altcxx::TextWriter writer(altcxx::TextWriter::Format::JSON, 16);
+  writer.write(root.asReader());
+  EXPECT_EQ("{\"foo\":1,\"middle\":0}", kj::str(writer.getText()));
+  writer.clear();
+  root.middle = 2;
+  EXPECT_EQ("{\"foo\":1,\"middle\":2}", writer.write(root.asReader()).finish());
+  EXPECT_EQ(0u, writer.getText().size());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,128 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/altc++/validate.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+TEST(Validate, SingleSegment) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+
+  altcxx::MessageValidator validator(reader);
+  validator.validate<TestAllTypes>();
+  EXPECT_FALSE(validator.hasFarPointers());
+
+  altcxx::TrustedMessage<TestAllTypes> trusted(reader);
+  checkTestMessage(trusted.getRoot());
+}
+
+TEST(Validate, MultiSegment) {
+  MallocMessageBuilder builder(1, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto segments = builder.getSegmentsForOutput();
+  ASSERT_GT(segments.size(), 1u);
+  SegmentArrayMessageReader reader(segments);
+
+  altcxx::MessageValidator validator(reader);
+  validator.validate<TestAllTypes>();
+  EXPECT_TRUE(validator.hasFarPointers());
+
+  altcxx::TrustedMessage<TestAllTypes> trusted(reader);
+  checkTestMessage(trusted.getRoot());
+}
+
+TEST(Validate, OutOfBounds) {
+  MallocMessageBuilder builder;
+  builder.initRoot<TestAllTypes>().textField = "foo";
+  auto segment = builder.getSegmentsForOutput()[0];
+
+  // Drop the text's contents off the end of the segment.
+  kj::ArrayPtr<const word> truncated[1] = { segment.slice(0, segment.size() - 1) };
+  SegmentArrayMessageReader reader(truncated);
+  EXPECT_ANY_THROW(altcxx::MessageValidator(reader).validate<TestAllTypes>());
+  EXPECT_ANY_THROW(altcxx::TrustedMessage<TestAllTypes>{reader});
+
+  word garbage[4];
+  memset(garbage, 0xff, sizeof(garbage));
+  kj::ArrayPtr<const word> bad[1] = { kj::arrayPtr(garbage, 4) };
+  SegmentArrayMessageReader badReader(bad);
+  EXPECT_ANY_THROW(altcxx::MessageValidator(badReader).validate<TestAllTypes>());
+}
+
+TEST(Validate, Limits) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.structField.structField.structField.int32Field = 1;
+  SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+
+  altcxx::MessageValidator::Options options;
+  options.nestingLimit = 2;
+  EXPECT_ANY_THROW(altcxx::MessageValidator(reader, options).validate<TestAllTypes>());
+  options.nestingLimit = 4;
+  altcxx::MessageValidator(reader, options).validate<TestAllTypes>();
+
+  options.traversalLimitInWords = 8;
+  EXPECT_ANY_THROW(altcxx::MessageValidator(reader, options).validate<TestAllTypes>());
+}
+
+TEST(Validate, Parallel) {
+  MallocMessageBuilder builder;
+  auto list = builder.initRoot<TestAllTypes>().structList.init(10000);
+  for (uint i = 0; i < list.size(); i++) {
+    list[i].textField = kj::str(i).cStr();
+  }
+
+  altcxx::WorkStealingPool pool(4);
+  altcxx::MessageValidator::Options options;
+  options.pool = &pool;
+  options.parallelThreshold = 64;
+
+  {
+    SegmentArrayMessageReader reader(builder.getSegmentsForOutput());
+    altcxx::TrustedMessage<TestAllTypes> trusted(reader, options);
+    auto readList = trusted.getRoot().structList;
+    ASSERT_EQ(10000u, readList.size());
+    for (uint i = 0; i < readList.size(); i++) {
+      EXPECT_EQ(kj::str(i), readList[i].textField.get());
+    }
+  }
+
+  // One bad element anywhere in the list must fail the whole message.
+  auto segment = builder.getSegmentsForOutput()[0];
+  kj::ArrayPtr<const word> truncated[1] = { segment.slice(0, segment.size() - 1) };
+  SegmentArrayMessageReader reader(truncated);
+  EXPECT_ANY_THROW(altcxx::MessageValidator(reader, options).validate<TestAllTypes>());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
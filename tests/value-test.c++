@@ -0,0 +1,116 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// Copyright (c) 2014, Jakub Spiewak <j.m.spiewak@gmil.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <capnp/message.h>
+#include <gtest/gtest.h>
+#include <unordered_set>
+#include <vector>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+constexpr test::TestValuePoint::Value ORIGIN(0, 0, test::TestEnum::FOO);
+
+TEST(Value, Properties) {
+  test::TestValuePoint::Value point;
+  EXPECT_EQ_CAST(0, point.x);
+  EXPECT_EQ_CAST(-1, point.y);
+  EXPECT_EQ_CAST(test::TestEnum::BAR, point.kind);
+
+  point.x = 3;
+  point.kind = test::TestEnum::QUX;
+  test::TestValuePoint::Value copy = point;
+  EXPECT_EQ_CAST(3, copy.x);
+  EXPECT_EQ_CAST(test::TestEnum::QUX, copy.kind);
+  EXPECT_TRUE(copy == point);
+
+  copy.y = point.x;
+  EXPECT_EQ_CAST(3, copy.y);
+  EXPECT_TRUE(copy != point);
+
+  EXPECT_EQ_CAST(0, ORIGIN.x);
+  EXPECT_EQ_CAST(0, ORIGIN.y);
+  EXPECT_EQ_CAST(test::TestEnum::FOO, ORIGIN.kind);
+
+  test::TestValueSample::Value sample;
+  EXPECT_EQ_CAST(1.5, sample.level);
+  sample = test::TestValueSample::Value(10, 2.5, 7);
+  EXPECT_EQ_CAST(10u, sample.at);
+  EXPECT_EQ_CAST(2.5, sample.level);
+  EXPECT_EQ_CAST(7u, sample.code);
+}
+
+TEST(Value, Messages) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestValuePoint>();
+
+  // A default Value has the same bytes as an empty struct.
+  EXPECT_TRUE(root.asReader().toValue() == test::TestValuePoint::Value());
+
+  root.x = 12;
+  root.kind = test::TestEnum::BAZ;
+  auto value = root.asReader().toValue();
+  EXPECT_EQ_CAST(12, value.x);
+  EXPECT_EQ_CAST(-1, value.y);
+  EXPECT_EQ_CAST(test::TestEnum::BAZ, value.kind);
+
+  value.y = 34;
+  root.copyFrom(value);
+  EXPECT_EQ_CAST(12, root.x);
+  EXPECT_EQ_CAST(34, root.y);
+  EXPECT_EQ_CAST(test::TestEnum::BAZ, root.kind);
+}
+
+TEST(Value, Lists) {
+  std::vector<test::TestValueSample::Value> samples;
+  for (uint i = 0; i < 100; i++) {
+    samples.push_back(test::TestValueSample::Value(i, i * 0.5, i % 7));
+  }
+
+  MallocMessageBuilder builder;
+  auto list = builder.initRoot<test::TestValueList>().samples.init(samples.size());
+  altcxx::copyValues<test::TestValueSample>(
+      kj::arrayPtr<const test::TestValueSample::Value>(samples.data(), samples.size()), list);
+  for (uint i = 0; i < list.size(); i++) {
+    EXPECT_EQ_CAST(i, list[i].at);
+    EXPECT_EQ_CAST(i * 0.5, list[i].level);
+    EXPECT_EQ_CAST(i % 7, list[i].code);
+  }
+
+  std::vector<test::TestValueSample::Value> copies(samples.size());
+  altcxx::copyValues<test::TestValueSample>(
+      list.asReader(), kj::arrayPtr(copies.data(), copies.size()));
+  EXPECT_TRUE(copies == samples);
+
+  std::unordered_set<test::TestValueSample::Value, altcxx::ValueHash> set(
+      copies.begin(), copies.end());
+  EXPECT_EQ(samples.size(), set.size());
+  EXPECT_EQ(1u, set.count(test::TestValueSample::Value(5, 2.5, 5)));
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp